@@ -6,137 +6,158 @@
 #include <sys/wait.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <math.h>
 #include <errno.h>
 #include <sys/select.h>
+#include <poll.h>
 #include <pthread.h>
 #include "helper.h"
+#include "physics.h"
+#include "latency.h"
+#include "tick_scheduler.h"
+#include "physics_pool.h"
+#include "frame.h"
+#include "world.h"
+#include "ready.h"
+#include "heartbeat.h"
 
 FILE *debug, *errors;                               // File descriptors for the two log files
-pid_t wd_pid;
-float rho0 = 2, rho1 = 0.5, rho2 = 2, eta = 40;
-Game game;
-Drone *drone;
-//Object obstacles, targets;
-
-float calculate_friction_force(float velocity) {
-    return -FRICTION_COEFFICIENT * velocity;
-}
-
-float calculate_repulsive_forcex(Drone drone, int xo, int yo) {
-    float rho = sqrt(pow(drone.pos_x - xo, 2) + pow(drone.pos_y - yo, 2));
-    if (rho < 0.5) rho = 0.5;
-    float theta = atan2(drone.pos_y - yo, drone.pos_x - xo);
-    float fx;
-
-    if (rho < rho0) {
-        fx = eta * (1 / rho - 1 / rho0) * cos(theta) * fabs(drone.vel_x);
-    } else {
-        fx = 0;
+Swarm *swarm;
+World *world;
+Heartbeat *heartbeat;
+WorldSnapshot world_copy;           // Last set copied from the world shared memory
+LatencyHistogram key_apply_latency = LATENCY_HISTOGRAM("key pressed -> applied by the drone");
+LatencyHistogram key_tick_latency = LATENCY_HISTOGRAM("key pressed -> first physics tick");
+atomic_ullong pending_key_origin = 0;      // Origin of the last applied key, not yet seen by the physics
+volatile sig_atomic_t dump_requested = 0;
+pthread_mutex_t drone_mutex = PTHREAD_MUTEX_INITIALIZER;   // Serializes the writers of the shared state
+int server_write_fd = -1;                   // Control messages to the server
+TickScheduler scheduler;
+PhysicsPool pool;                           // Workers of the ticks, sized to the cores
+float physics_dt = T;                       // Simulated seconds advanced by each tick
+
+/**
+ * Advance every drone at each tick, split across the workers of the pool. The ticks run on a
+ * private copy of the swarm that is published with a single write only if some drone changed:
+ * the readers sleep while the swarm is still.
+ */
+void *update_drone_position_thread() {
+    size_t bytes = (size_t)swarm->count * sizeof(Drone);
+    Drone *next = malloc(bytes);
+    if (next == NULL) {
+        perror("Error allocating the copy of the swarm");
+        LOG_TO_FILE(errors, "Error allocating the copy of the swarm");
+        return NULL;
+    }
+    while (1) {
+        // Wait for the next deadline, then run the tick and the late ones if any
+        int ticks = tick_scheduler_wait(&scheduler);
+        uint64_t origin = atomic_exchange(&pending_key_origin, 0);
+        pthread_mutex_lock(&drone_mutex);
+        // Only this process writes the swarm and it holds the mutex, so the states are copied as they are
+        memcpy(next, swarm->drones, bytes);
+        int reached = 0;
+        for (int i = 0; i < ticks; i++) {
+            reached += physics_pool_tick(&pool, next, swarm->count, physics_dt);
+        }
+        if (memcmp(next, swarm->drones, bytes) != 0) {
+            swarm_write_begin(swarm);
+            memcpy(swarm->drones, next, bytes);
+            swarm_write_end(swarm);
+        }
+        int left = target_set != NULL ? target_set->left : 0;
+        uint32_t target_generation = target_set != NULL ? target_set->generation : 0;
+        pthread_mutex_unlock(&drone_mutex);
+        if (origin != 0) latency_record(&key_tick_latency, monotonic_ns() - origin);
+        if (reached > 0) {
+            LOG_EVENT(debug, "Reached %d targets, %d left", reached, left);
+            // The server asks for a new set at once instead of waiting for the end of the period
+            if (left == 0 && server_write_fd != -1 && frame_control(server_write_fd, 'c', target_generation) == -1) {
+                LOG_TO_FILE(errors, "Error telling the server that every target was reached");
+            }
+        }
     }
-
-    if (fx > MAX_FREP) fx = MAX_FREP;
-    if (fx < -MAX_FREP) fx = -MAX_FREP;
-
-    return fx;
 }
 
-float calculate_repulsive_forcey(Drone drone, int xo, int yo) {
-    float rho = sqrt(pow(drone.pos_x - xo, 2) + pow(drone.pos_y - yo, 2));
-    if (rho < 0.5) rho = 0.5;
-    float theta = atan2(drone.pos_y - yo, drone.pos_x - xo);
-    float fy;
-
-    if (rho < rho0) {
-        fy = eta * (1 / rho - 1 / rho0) * sin(theta) * fabs(drone.vel_y);
-    } else {
-        fy = 0;
+// Take the coordinates of a set: from the records of the frame, or from the world shared memory when the frame only announces it
+int load_objects(const FrameBuffer *frame, int set, ObstacleBuffer *objects) {
+    if (frame->header.flags & FRAME_FLAG_SHARED) {
+        if (world_read(world, set, &world_copy) == -1 || obstacle_buffer_reserve(objects, world_copy.count) == -1) return -1;
+        for (uint32_t i = 0; i < world_copy.count; i++) {
+            objects->x[i] = world_copy.x[i];
+            objects->y[i] = world_copy.y[i];
+        }
+        objects->count = world_copy.count;
+        return objects->count;
     }
 
-    if (fy > MAX_FREP) fy = MAX_FREP;
-    if (fy < -MAX_FREP) fy = -MAX_FREP;
-
-    return fy;
+    int count = frame->header.count;
+    if (obstacle_buffer_reserve(objects, count) == -1) return -1;
+    for (int i = 0; i < count; i++) {
+        objects->x[i] = frame->objects[i].pos_x;
+        objects->y[i] = frame->objects[i].pos_y;
+    }
+    objects->count = count;
+    return count;
 }
 
-void update_drone_position(Drone *drone, float dt) {
-    float fx_obs = 0;
-    float fy_obs = 0;
+// Index a new set of obstacles and hand it to the physics, the old one is freed after the swap
+void set_obstacles(const FrameBuffer *frame) {
+    ObstacleBuffer objects = {0};
+    SpatialGrid *grid = malloc(sizeof(SpatialGrid));
+    if (grid == NULL || load_objects(frame, WORLD_OBSTACLES, &objects) == -1 ||
+        grid_build(grid, objects.x, objects.y, objects.count, game.max_x, game.max_y, rho0) == -1) {
+        LOG_TO_FILE(errors, "Error indexing the obstacles");
+        free(grid);
+        obstacle_buffer_free(&objects);
+        return;
+    }
+    obstacle_buffer_free(&objects);
 
-    float frictionForceX = calculate_friction_force(drone->vel_x);
-    float frictionForceY = calculate_friction_force(drone->vel_y);
-    
-    float accelerationX = (drone->force_x + frictionForceX + fx_obs) / MASS;
-    float accelerationY = (drone->force_y + frictionForceY + fy_obs) / MASS;
-
-    drone->vel_x += accelerationX * dt;
-    drone->vel_y += accelerationY * dt;
-    drone->pos_x += drone->vel_x * dt + 0.5 * accelerationX * dt * dt;
-    drone->pos_y += drone->vel_y * dt + 0.5 * accelerationY * dt * dt;
-
-    if (drone->pos_x < 0) { drone->pos_x = 0; drone->vel_x = 0; drone->force_x = 0;}
-    if (drone->pos_x >= game.max_x) { drone->pos_x = game.max_x - 1; drone->vel_x = 0; drone->force_x = 0;}
-    if (drone->pos_y < 0) {drone->pos_y = 0; drone->vel_y = 0; drone->force_y = 0;}
-    if (drone->pos_y >= game.max_y) { drone->pos_y = game.max_y - 1; drone->vel_y = 0; drone->force_y = 0;}
-}
+    pthread_mutex_lock(&drone_mutex);
+    SpatialGrid *old = obstacle_grid;
+    obstacle_grid = grid;
+    pthread_mutex_unlock(&drone_mutex);
 
-void *update_drone_position_thread() {
-    while (1) {
-        //sem_wait(drone->sem);
-        update_drone_position(drone, T);
-        //sem_post(drone->sem);
-        usleep(50000);
+    if (old != NULL) {
+        grid_free(old);
+        free(old);
     }
 }
 
-void handle_key_pressed(char key, Drone *drone) {
-    switch (key) {
-        case 'w': case 'W':
-            drone->force_x -= 0.25;
-            drone->force_y -= 0.25;
-            break;
-        case 'e': case 'E':
-            drone->force_x -= 0;
-            drone->force_y -= 0.5;
-            break;
-        case 'r': case 'R':
-            drone->force_x += 0.25;
-            drone->force_y -= 0.25;
-            break;
-        case 's': case 'S':
-            drone->force_x -= 0.5;
-            drone->force_y += 0;
-            break;
-        case 'd': case 'D':
-            drone->force_x = 0;
-            drone->force_y = 0;
-            break;
-        case 'f': case 'F':
-            drone->force_x += 0.5;
-            drone->force_y += 0;
-            break;
-        case 'x': case 'X':
-            drone->force_x -= 0.25;
-            drone->force_y += 0.25;
-            break;
-        case 'c': case 'C':
-            drone->force_x += 0;
-            drone->force_y += 0.5;
-            break;
-        case 'v': case 'V':
-            drone->force_x += 0.25;
-            drone->force_y += 0.25;
-            break;
-        default:
-            break;
+// Index a new set of targets and hand it to the physics, the old one is freed after the swap
+void set_targets(const FrameBuffer *frame) {
+    ObstacleBuffer objects = {0};
+    TargetSet *targets = calloc(1, sizeof(TargetSet));
+    if (targets == NULL || load_objects(frame, WORLD_TARGETS, &objects) == -1 ||
+        (targets->reached = calloc(objects.count > 0 ? objects.count : 1, 1)) == NULL ||
+        grid_build(&targets->grid, objects.x, objects.y, objects.count, game.max_x, game.max_y, rho0) == -1) {
+        LOG_TO_FILE(errors, "Error indexing the targets");
+        if (targets != NULL) free(targets->reached);
+        free(targets);
+        obstacle_buffer_free(&objects);
+        return;
+    }
+    targets->left = objects.count;
+    targets->generation = frame->header.generation;
+    obstacle_buffer_free(&objects);
+
+    pthread_mutex_lock(&drone_mutex);
+    TargetSet *old = target_set;
+    target_set = targets;
+    pthread_mutex_unlock(&drone_mutex);
+
+    if (old != NULL) {
+        grid_free(&old->grid);
+        free(old->reached);
+        free(old);
     }
 }
 
 void signal_handler(int sig, siginfo_t* info, void *context) {
-    if (sig == SIGUSR1) {
-        wd_pid = info->si_pid;
-        LOG_TO_FILE(debug, "Signal SIGUSR1 received from WATCHDOG");
-        kill(wd_pid, SIGUSR1);
+    if (sig == LATENCY_DUMP_SIGNAL) {
+        dump_requested = 1;
     }
 
     if (sig == SIGUSR2) {
@@ -158,8 +179,10 @@ int open_shared_memory() {
         fclose(errors);   
         exit(EXIT_FAILURE);
     }
-    drone = (Drone *)mmap(0, sizeof(Drone), PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
-    if (drone == MAP_FAILED) {
+    // The segment is sized by the server for its number of drones
+    struct stat info;
+    swarm = fstat(mem_fd, &info) == -1 ? MAP_FAILED : (Swarm *)mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (swarm == MAP_FAILED) {
         perror("Error mapping the shared memory");
         LOG_TO_FILE(errors, "Error mapping the shared memoryd");
         // Close the files
@@ -170,8 +193,33 @@ int open_shared_memory() {
     return mem_fd;
 }
 
+int open_world_memory() {
+    int world_fd = shm_open(WORLD_SHARED_MEMORY, O_RDONLY, 0666);
+    struct stat info;
+    if (world_fd == -1 || fstat(world_fd, &info) == -1) {
+        perror("Error opening the world shared memory");
+        LOG_TO_FILE(errors, "Error opening the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+    world = (World *)mmap(0, info.st_size, PROT_READ, MAP_SHARED, world_fd, 0);
+    if (world == MAP_FAILED || world->magic != WORLD_MAGIC) {
+        perror("Error mapping the world shared memory");
+        LOG_TO_FILE(errors, "Error mapping the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+    return world_fd;
+}
+
 void drone_process(int map_read_fd, int input_read_fd, int obstacles_read_fd, int targets_read_fd) {
-    char buffer[256];
+    FrameBuffer obstacles_frame = {0}, targets_frame = {0};     // A streamed set is assembled in the buffer of its pipe
+    char sizes[256];                                            // Map sizes received from the server, up to an incomplete line
+    size_t sizes_length = 0;
     fd_set read_fds;
     struct timeval timeout;
 
@@ -190,14 +238,28 @@ void drone_process(int map_read_fd, int input_read_fd, int obstacles_read_fd, in
     }
 
     while(1) {
+        if (dump_requested) {
+            dump_requested = 0;
+            char message[256];
+            latency_format(&key_apply_latency, message, sizeof(message));
+            LOG_TO_FILE(debug, message);
+            latency_format(&key_tick_latency, message, sizeof(message));
+            LOG_TO_FILE(debug, message);
+            tick_scheduler_format(&scheduler, message, sizeof(message));
+            LOG_TO_FILE(debug, message);
+        }
+
         FD_ZERO(&read_fds);
         FD_SET(map_read_fd, &read_fds);
         FD_SET(input_read_fd, &read_fds);
-        FD_SET(obstacles_read_fd, &read_fds);
-        FD_SET(targets_read_fd, &read_fds);
-
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        // A pipe closed by the server is no longer watched
+        if (obstacles_read_fd != -1) FD_SET(obstacles_read_fd, &read_fds);
+        if (targets_read_fd != -1) FD_SET(targets_read_fd, &read_fds);
+
+        // The loop beats at every iteration, so it never waits longer than HEARTBEAT_INTERVAL_MS
+        heartbeat_beat(heartbeat, PROC_DRONE);
+        timeout.tv_sec = HEARTBEAT_INTERVAL_MS / 1000;
+        timeout.tv_usec = HEARTBEAT_INTERVAL_MS % 1000 * 1000;
         int activity;
         do {
             activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
@@ -209,39 +271,74 @@ void drone_process(int map_read_fd, int input_read_fd, int obstacles_read_fd, in
             break;
         } else if (activity > 0) {
             if (FD_ISSET(map_read_fd, &read_fds)) {
-                ssize_t bytes_read = read(map_read_fd, buffer, sizeof(buffer) - 1);
+                ssize_t bytes_read = read(map_read_fd, sizes + sizes_length, sizeof(sizes) - 1 - sizes_length);
                 if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0';
-                    sscanf(buffer, "%d, %d", &game.max_x, &game.max_y);
+                    sizes_length += bytes_read;
+                    sizes[sizes_length] = '\0';
+                    // One "width, height" per line: after back to back resizes only the last one counts
+                    char *line = sizes, *end;
+                    while ((end = strchr(line, '\n')) != NULL) {
+                        *end = '\0';
+                        sscanf(line, "%d, %d", &game.max_x, &game.max_y);
+                        line = end + 1;
+                    }
+                    // Keep the incomplete line for the next read, a line that fills the buffer is dropped
+                    sizes_length -= line - sizes;
+                    if (sizes_length == sizeof(sizes) - 1) sizes_length = 0;
+                    memmove(sizes, line, sizes_length);
                 }
             }
             if (FD_ISSET(input_read_fd, &read_fds)) {
-                ssize_t bytes_read = read(input_read_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0';
-                    //sem_wait(drone->sem);
-                    handle_key_pressed(buffer[0], drone);
-                    //sem_post(drone->sem);
+                KeyMessage messages[16];
+                ssize_t bytes_read = read(input_read_fd, messages, sizeof(messages));
+                for (size_t i = 0; bytes_read > 0 && i < bytes_read / sizeof(KeyMessage); i++) {
+                    // The server only forwards the keys of an existing drone or of the whole swarm
+                    int first = messages[i].drone == DRONE_ALL ? 0 : messages[i].drone;
+                    int last = messages[i].drone == DRONE_ALL ? swarm->count - 1 : messages[i].drone;
+                    if (first < 0 || last >= swarm->count) continue;
+                    pthread_mutex_lock(&drone_mutex);
+                    swarm_write_begin(swarm);
+                    for (int j = first; j <= last; j++) {
+                        handle_key_pressed(messages[i].key, &swarm->drones[j]);
+                    }
+                    swarm_write_end(swarm);
+                    pthread_mutex_unlock(&drone_mutex);
+                    latency_record(&key_apply_latency, monotonic_ns() - messages[i].origin);
+                    atomic_store(&pending_key_origin, messages[i].origin);
                 }
             }
-            if (FD_ISSET(obstacles_read_fd, &read_fds)) {
-                ssize_t bytes_read = read(obstacles_read_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0';
-                    //sscanf(buffer, "%d, %d, %d, %c", &objects.pos_x, &objects.pos_y, &objects.point, &objects.type);
-                    LOG_TO_FILE(errors, buffer);
+            // One frame is read per pipe and iteration, a streamed set is indexed once its last chunk arrives
+            if (obstacles_read_fd != -1 && FD_ISSET(obstacles_read_fd, &read_fds)) {
+                // The records are indexed straight from the receive buffer
+                int n = frame_read(obstacles_read_fd, &obstacles_frame);
+                if (n == 1) {
+                    set_obstacles(&obstacles_frame);
+                    LOG_EVENT(debug, "Received generation %u with %u obstacles", obstacles_frame.header.generation, obstacles_frame.header.count);
+                } else if (n == 0) {
+                    LOG_TO_FILE(debug, "The server closed the pipe of the obstacles");
+                    close(obstacles_read_fd);
+                    obstacles_read_fd = -1;
+                } else if (n == -1) {
+                    LOG_TO_FILE(errors, "Invalid frame of obstacles");
                 }
             }
-            if (FD_ISSET(targets_read_fd, &read_fds)) {
-                ssize_t bytes_read = read(targets_read_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0';
-                    //sscanf(buffer, "%d, %d, %d, %c", &objects.pos_x, &objects.pos_y, &objects.point, &objects.type);
-                    LOG_TO_FILE(errors, buffer);
+            if (targets_read_fd != -1 && FD_ISSET(targets_read_fd, &read_fds)) {
+                int n = frame_read(targets_read_fd, &targets_frame);
+                if (n == 1) {
+                    set_targets(&targets_frame);
+                    LOG_EVENT(debug, "Received generation %u with %u targets", targets_frame.header.generation, targets_frame.header.count);
+                } else if (n == 0) {
+                    LOG_TO_FILE(debug, "The server closed the pipe of the targets");
+                    close(targets_read_fd);
+                    targets_read_fd = -1;
+                } else if (n == -1) {
+                    LOG_TO_FILE(errors, "Invalid frame of targets");
                 }
             }
         }
     }
+    free(obstacles_frame.objects);
+    free(targets_frame.objects);
 }
 
 int main(int argc, char* argv[]) {
@@ -256,6 +353,8 @@ int main(int argc, char* argv[]) {
         perror("Error opening the errors file");
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
 
     if (argc < 5) {
         LOG_TO_FILE(errors, "Invalid number of parameters");
@@ -272,6 +371,17 @@ int main(int argc, char* argv[]) {
     int input_read_fd = atoi(argv[2]);
     int obstacles_read_fd = atoi(argv[3]);
     int targets_read_fd = atoi(argv[4]);
+    // The pipe to the server comes after the physics parameters
+    server_write_fd = argc > 8 ? atoi(argv[8]) : -1;
+
+    /* IMPORT THE CONFIGURATION OF THE PHYSICS */
+    // Ticks per second, simulated seconds per real second and late ticks that can be recovered
+    double physics_rate = argc > 5 ? atof(argv[5]) : PHYSICS_RATE;
+    double time_scale = argc > 6 ? atof(argv[6]) : TIME_SCALE;
+    int max_catch_up = argc > 7 ? atoi(argv[7]) : MAX_CATCH_UP;
+    if (physics_rate <= 0) physics_rate = PHYSICS_RATE;
+    if (time_scale <= 0) time_scale = TIME_SCALE;
+    physics_dt = time_scale / physics_rate;
 
     /* SETUP THE SIGNALS */
     struct sigaction sa;
@@ -279,19 +389,20 @@ int main(int argc, char* argv[]) {
     sa.sa_sigaction = signal_handler;
     sigemptyset(&sa.sa_mask);
 
-    // Set the signal handler for SIGUSR1
-    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
-        perror("Error in sigaction(SIGURS1)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS1)");
+    // Set the signal handler for SIGUSR2
+    if(sigaction(SIGUSR2, &sa, NULL) == -1){
+        perror("Error in sigaction(SIGURS2)");
+        LOG_TO_FILE(errors, "Error in sigaction(SIGURS2)");
         // Close the files
         fclose(debug);
         fclose(errors);
         exit(EXIT_FAILURE);
     }
-    // Set the signal handler for SIGUSR2
-    if(sigaction(SIGUSR2, &sa, NULL) == -1){
-        perror("Error in sigaction(SIGURS2)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS2)");
+
+    // Set the signal handler for the latency dump
+    if(sigaction(LATENCY_DUMP_SIGNAL, &sa, NULL) == -1){
+        perror("Error in sigaction(LATENCY_DUMP_SIGNAL)");
+        LOG_TO_FILE(errors, "Error in sigaction(LATENCY_DUMP_SIGNAL)");
         // Close the files
         fclose(debug);
         fclose(errors);
@@ -300,24 +411,50 @@ int main(int argc, char* argv[]) {
 
     /* OPEN THE SHARED MEMORY */
     int mem_fd = open_shared_memory();
+    int world_fd = open_world_memory();
+
+    /* OPEN THE HEARTBEAT */
+    heartbeat = heartbeat_open();
+    if (heartbeat == NULL) {
+        perror("Error opening the heartbeat shared memory");
+        LOG_TO_FILE(errors, "Error opening the heartbeat shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
+    heartbeat_beat(heartbeat, PROC_DRONE);
+
+    /* REPORT TO THE LAUNCHER */
+    if (ready_notify(PROC_DRONE) == -1) {
+        perror("Error reporting to the launcher");
+        LOG_TO_FILE(errors, "Error reporting to the launcher");
+    }
 
     /* IMPORT THE INITIAL CONFIGURATION */
-    // Wait 2 seconds
-    int diff;
-    time_t start, finish;
-    time(&start);
-    do {
-        time(&finish);
-        diff = difftime(finish, start);
-    } while (diff < 2);
-
-    // Read the size of the map from the server
+    // Read the size of the map from the server as soon as the map has sent it
     char buffer[50];
+    struct pollfd map_size = {map_read_fd, POLLIN, 0};
+    while (poll(&map_size, 1, HEARTBEAT_INTERVAL_MS) <= 0) {
+        heartbeat_beat(heartbeat, PROC_DRONE);
+    }
     read(map_read_fd, buffer, sizeof(buffer) - 1);
     sscanf(buffer, "%d, %d", &game.max_x, &game.max_y);
     
     /* UPDATE THE DRONE POSITION */
     // Start the thread to continuously update the drone's information
+    tick_scheduler_init(&scheduler, physics_rate, max_catch_up);
+    if (physics_pool_init(&pool, swarm->count, 0) == -1) {
+        perror("Error starting the workers of the physics");
+        LOG_TO_FILE(errors, "Error starting the workers of the physics");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+    char workers_message[64];
+    snprintf(workers_message, sizeof(workers_message), "Physics of %d drones on %d workers", swarm->count, pool.workers);
+    LOG_TO_FILE(debug, workers_message);
     pthread_t drone_thread;
     if (pthread_create(&drone_thread, NULL, update_drone_position_thread, NULL) != 0) {
         perror("Error creating the thread for updating the drone's information");
@@ -342,7 +479,11 @@ int main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
     }
     // Unmap the shared memory region
-    munmap(drone, sizeof(Drone));
+    munmap(swarm, swarm_size(swarm->count));
+    // Unmap the world
+    close(world_fd);
+    munmap(world, world->size);
+    world_snapshot_free(&world_copy);
     
     // Close the files
     fclose(debug);
@@ -0,0 +1,117 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+
+#define EVENT_LOOP_BATCH 32                 // Events dispatched per epoll_wait
+
+/**
+ * Edge-triggered epoll loop with one handler per file descriptor.
+ * A handler is called once per readiness change, so it has to consume everything that is
+ * available on its fd (event_pending tells how much is left) before returning.
+ * Sources can be added and removed at any time, also from inside a handler.
+ */
+typedef void (*EventHandler)(int fd, uint32_t events, void *context);
+
+typedef struct {
+    EventHandler handler;                   // NULL when the fd is not registered
+    void *context;
+} EventSource;
+
+typedef struct {
+    int epoll_fd;
+    EventSource *sources;                   // Indexed by file descriptor
+    int capacity;
+    int count;
+} EventLoop;
+
+static int event_loop_init(EventLoop *loop) {
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    loop->sources = NULL;
+    loop->capacity = 0;
+    loop->count = 0;
+    return loop->epoll_fd == -1 ? -1 : 0;
+}
+
+// Register fd for edge-triggered input, hang-ups are delivered to the same handler
+static int event_loop_add(EventLoop *loop, int fd, EventHandler handler, void *context) {
+    if (fd < 0 || handler == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (fd >= loop->capacity) {
+        int capacity = loop->capacity > 0 ? loop->capacity : 16;
+        while (capacity <= fd) capacity *= 2;
+        EventSource *sources = realloc(loop->sources, sizeof(EventSource) * capacity);
+        if (sources == NULL) return -1;
+        for (int i = loop->capacity; i < capacity; i++) {
+            sources[i].handler = NULL;
+            sources[i].context = NULL;
+        }
+        loop->sources = sources;
+        loop->capacity = capacity;
+    }
+
+    struct epoll_event event = {0};
+    event.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+    if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) return -1;
+    loop->sources[fd].handler = handler;
+    loop->sources[fd].context = context;
+    loop->count++;
+    return 0;
+}
+
+static int event_loop_remove(EventLoop *loop, int fd) {
+    if (fd < 0 || fd >= loop->capacity || loop->sources[fd].handler == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+    loop->sources[fd].handler = NULL;
+    loop->sources[fd].context = NULL;
+    loop->count--;
+    return epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/**
+ * Wait up to timeout_ms for events and dispatch them.
+ * Returns the number of handlers called, 0 on timeout or signal, -1 on errors.
+ */
+static int event_loop_wait(EventLoop *loop, int timeout_ms) {
+    struct epoll_event events[EVENT_LOOP_BATCH];
+    int n = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_BATCH, timeout_ms);
+    if (n == -1) return errno == EINTR ? 0 : -1;
+
+    int dispatched = 0;
+    for (int i = 0; i < n; i++) {
+        int fd = events[i].data.fd;
+        // A previous handler of the batch may have removed this source
+        if (fd >= loop->capacity || loop->sources[fd].handler == NULL) continue;
+        loop->sources[fd].handler(fd, events[i].events, loop->sources[fd].context);
+        dispatched++;
+    }
+    return dispatched;
+}
+
+static void event_loop_free(EventLoop *loop) {
+    if (loop->epoll_fd != -1) close(loop->epoll_fd);
+    free(loop->sources);
+    loop->epoll_fd = -1;
+    loop->sources = NULL;
+    loop->capacity = 0;
+    loop->count = 0;
+}
+
+// Bytes that can be read from fd without blocking, -1 on errors
+static int event_pending(int fd) {
+    int bytes;
+    if (ioctl(fd, FIONREAD, &bytes) == -1) return -1;
+    return bytes;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// tee() and splice() are GNU extensions: define _GNU_SOURCE before the first include
+#define FANOUT_CHUNK 65536                  // Bytes moved per round, one default pipe buffer
+#define FANOUT_MAX_OUTPUTS 8                // Outputs of one fanout
+
+// Write exactly `size` bytes, retrying after partial writes and signals
+static ssize_t fanout_write(int fd, const char *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, data + done, size - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return done;
+}
+
+/**
+ * Slow path of a round: consume `chunk` bytes from the input and write to every output
+ * the part that the kernel did not duplicate already (sent[i] bytes).
+ */
+static int fanout_copy(int in_fd, const int *out_fds, const size_t *sent, int n_out, size_t chunk) {
+    // Kept off the stack, the fanouts of a process all run in its event loop
+    static char buffer[FANOUT_CHUNK];
+    size_t done = 0;
+    while (done < chunk) {
+        ssize_t n = read(in_fd, buffer + done, chunk - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    for (int i = 0; i < n_out; i++) {
+        if (sent[i] < chunk && fanout_write(out_fds[i], buffer + sent[i], chunk - sent[i]) == -1) return -1;
+    }
+    return 0;
+}
+
+/**
+ * Move `size` bytes from the pipe in_fd to every pipe in out_fds without copying them to
+ * user space: tee() duplicates the bytes in the first n_out - 1 outputs and splice() moves
+ * them in the last one, which consumes them from the input.
+ * When an output takes only part of a round (its buffer is full) or is not a pipe, that
+ * round falls back to read() + write(), so every output always receives the whole payload.
+ * Returns 0 on success, -1 on errors.
+ */
+static int pipe_fanout(int in_fd, const int *out_fds, int n_out, size_t size) {
+    if (n_out <= 0 || n_out > FANOUT_MAX_OUTPUTS) {
+        errno = EINVAL;
+        return -1;
+    }
+    size_t sent[FANOUT_MAX_OUTPUTS];
+
+    while (size > 0) {
+        size_t chunk = size < FANOUT_CHUNK ? size : FANOUT_CHUNK;
+        int copy = 0;
+
+        for (int i = 0; i < n_out; i++) sent[i] = 0;
+        for (int i = 0; i < n_out - 1 && !copy; i++) {
+            ssize_t n;
+            do {
+                n = tee(in_fd, out_fds[i], chunk, 0);
+            } while (n == -1 && errno == EINTR);
+            if (n == -1 && errno != EINVAL) return -1;
+            if (n <= 0) {
+                copy = 1;
+            } else if (i == 0) {
+                // Only what is already in the input can be duplicated: that is the round
+                chunk = n;
+                sent[i] = n;
+            } else {
+                sent[i] = n;
+                if ((size_t)n < chunk) copy = 1;
+            }
+        }
+
+        if (copy) {
+            if (fanout_copy(in_fd, out_fds, sent, n_out, chunk) == -1) return -1;
+        } else {
+            // Every other output has the round: move it to the last one
+            int last = n_out - 1;
+            while (sent[last] < chunk) {
+                ssize_t n = splice(in_fd, NULL, out_fds[last], NULL, chunk - sent[last], SPLICE_F_MOVE);
+                if (n == -1 && errno == EINTR) continue;
+                if (n == -1 && errno == EINVAL && sent[last] == 0) {
+                    if (fanout_copy(in_fd, out_fds, sent, n_out, chunk) == -1) return -1;
+                    break;
+                }
+                if (n <= 0) return -1;
+                sent[last] += n;
+            }
+        }
+        size -= chunk;
+    }
+    return 0;
+}
+
+#endif
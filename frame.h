@@ -0,0 +1,220 @@
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/uio.h>
+
+#define FRAME_MAGIC 0x444c5257u             // "WRLD" in little endian
+#define FRAME_VERSION 2
+#define FRAME_MAX_OBJECTS (1 << 24)         // Frames announcing more objects are rejected as corrupted
+#define FRAME_CHUNK_OBJECTS 4096            // Records in one frame, a set is streamed in as many frames as needed
+#define FRAME_FLAG_SHARED 0x01              // The records are in the world shared memory, not in the frame
+#define FRAME_PARTIAL 2                     // Returned by frame_read when a chunk was stored but the set is not complete
+
+/**
+ * Binary frame carrying a set of obstacles or targets through the pipes.
+ * A FrameHeader is followed by `count` WireObject records. The records are 4-byte aligned
+ * and have no pointers, so the receiver uses them straight from its receive buffer.
+ * A set is streamed as a sequence of frames of at most FRAME_CHUNK_OBJECTS records: every frame
+ * holds the records [offset, offset + count) of a set of `total`, numbered from sequence 0.
+ * The receiver stores each chunk in place as it arrives, so no hop reads more than one chunk
+ * at a time and a large set never stalls the loop of the process that forwards it.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t type;                           // 'o' for obstacles, 't' for targets, 'c' when every target was reached
+    uint8_t flags;                          // FRAME_FLAG_*
+    uint32_t generation;                    // Incremented by the generator at every new set
+    uint32_t count;                         // Number of records following the header
+    uint32_t sequence;                      // Position of the frame in the stream of its set
+    uint32_t offset;                        // Index in the set of the first record of the frame
+    uint32_t total;                         // Records of the whole set
+} FrameHeader;
+
+typedef struct __attribute__((packed)) {
+    int32_t pos_x, pos_y;
+    int16_t point;
+    char type;
+    char reserved;
+} WireObject;
+
+// Receive buffer of one set, it grows to the largest set received
+typedef struct {
+    FrameHeader header;                     // Once the set is complete: count is its total and offset 0
+    WireObject *objects;
+    uint32_t capacity;
+    uint32_t received;                      // Records of the set being assembled
+    uint32_t next_sequence;                 // Sequence of the next chunk, 0 when no set is being assembled
+} FrameBuffer;
+
+// Read exactly `size` bytes, retrying after partial reads and signals
+static ssize_t read_full(int fd, void *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, (char *)data + done, size - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return n;
+        done += n;
+    }
+    return done;
+}
+
+// Write exactly `size` bytes, retrying after partial writes and signals
+static ssize_t write_full(int fd, const void *data, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = write(fd, (const char *)data + done, size - done);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += n;
+    }
+    return done;
+}
+
+// Send one chunk of a set: `count` records starting at `offset` of a set of `total`
+static int frame_write_chunk(int fd, char type, uint32_t generation, uint32_t sequence, uint32_t offset, uint32_t total,
+                             const WireObject *objects, uint32_t count) {
+    FrameHeader header = {FRAME_MAGIC, FRAME_VERSION, type, 0, generation, count, sequence, offset, total};
+    struct iovec parts[2] = {
+        {&header, sizeof(header)},
+        {(void *)objects, sizeof(WireObject) * count}
+    };
+    ssize_t n;
+    do {
+        n = writev(fd, parts, 2);
+    } while (n == -1 && errno == EINTR);
+    if (n == -1) return -1;
+
+    // A pipe may accept only part of a frame: send the rest
+    size_t size = sizeof(header) + sizeof(WireObject) * count;
+    if ((size_t)n < size) {
+        if ((size_t)n < sizeof(header)) {
+            if (write_full(fd, (char *)&header + n, sizeof(header) - n) == -1) return -1;
+            n = sizeof(header);
+        }
+        if (write_full(fd, (const char *)objects + (n - sizeof(header)), size - n) == -1) return -1;
+    }
+    return 0;
+}
+
+// Stream a whole set in chunks of FRAME_CHUNK_OBJECTS records, an empty set is one empty chunk
+static int frame_write(int fd, char type, uint32_t generation, const WireObject *objects, uint32_t count) {
+    uint32_t sequence = 0, offset = 0;
+    do {
+        uint32_t chunk = count - offset < FRAME_CHUNK_OBJECTS ? count - offset : FRAME_CHUNK_OBJECTS;
+        if (frame_write_chunk(fd, type, generation, sequence++, offset, count, objects + offset, chunk) == -1) return -1;
+        offset += chunk;
+    } while (offset < count);
+    return 0;
+}
+
+// Receive only the header of a frame, the records are left in the pipe
+static int frame_read_header(int fd, FrameHeader *header) {
+    ssize_t n = read_full(fd, header, sizeof(FrameHeader));
+    if (n <= 0) return n;
+    if (n != sizeof(FrameHeader) || header->magic != FRAME_MAGIC || header->version != FRAME_VERSION ||
+        header->total > FRAME_MAX_OBJECTS ||
+        (!(header->flags & FRAME_FLAG_SHARED) && (header->count > FRAME_CHUNK_OBJECTS || header->offset > header->total ||
+                                                  header->count > header->total - header->offset))) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 1;
+}
+
+// Announce that a new set was published in the world shared memory: only the header is sent
+static int frame_notify(int fd, char type, uint32_t generation, uint32_t count) {
+    FrameHeader header = {FRAME_MAGIC, FRAME_VERSION, type, FRAME_FLAG_SHARED, generation, count, 0, 0, count};
+    return write_full(fd, &header, sizeof(header)) == -1 ? -1 : 0;
+}
+
+// Send a header without records as a control message, like 'c' from the drone
+static int frame_control(int fd, char type, uint32_t generation) {
+    FrameHeader header = {FRAME_MAGIC, FRAME_VERSION, type, 0, generation, 0, 0, 0, 0};
+    return write_full(fd, &header, sizeof(header)) == -1 ? -1 : 0;
+}
+
+// Bytes of records following a header in the stream
+static inline size_t frame_payload_size(const FrameHeader *header) {
+    return header->flags & FRAME_FLAG_SHARED ? 0 : sizeof(WireObject) * header->count;
+}
+
+// True if the frame completes its set: a notification, a control message or the last chunk of a stream
+static inline int frame_is_last(const FrameHeader *header) {
+    return header->flags & FRAME_FLAG_SHARED || header->offset + header->count == header->total;
+}
+
+/**
+ * Receive the records of a frame whose header was already read, storing the chunk at its
+ * offset in the set being assembled in the buffer. A chunk out of sequence drops the set.
+ * Returns 1 once the set is complete (buffer->header.count objects start at buffer->objects),
+ * FRAME_PARTIAL while chunks are missing, 0 at end of file and -1 on errors.
+ * A frame with FRAME_FLAG_SHARED only announces a new set in the world shared memory and
+ * leaves the buffer's objects untouched.
+ */
+static int frame_receive(int fd, const FrameHeader *header, FrameBuffer *buffer) {
+    if (header->flags & FRAME_FLAG_SHARED) {
+        buffer->header = *header;
+        return 1;
+    }
+
+    // The first chunk starts a new set and gives its size, the others have to follow it in order
+    int expected = header->sequence == 0 ? header->offset == 0 :
+                   header->sequence == buffer->next_sequence && header->generation == buffer->header.generation &&
+                   header->total == buffer->header.total && header->offset == buffer->received;
+    if (header->sequence == 0) {
+        if (header->total > buffer->capacity) {
+            WireObject *objects = realloc(buffer->objects, sizeof(WireObject) * header->total);
+            if (objects == NULL) return -1;
+            buffer->objects = objects;
+            buffer->capacity = header->total;
+        }
+        buffer->header = *header;
+        buffer->received = 0;
+    }
+    if (!expected) {
+        // The records are still consumed, so the stream stays aligned on the next frame
+        WireObject discard[64];
+        size_t left = frame_payload_size(header);
+        while (left > 0) {
+            size_t part = left < sizeof(discard) ? left : sizeof(discard);
+            if (read_full(fd, discard, part) != (ssize_t)part) break;
+            left -= part;
+        }
+        buffer->next_sequence = 0;
+        errno = EPROTO;
+        return -1;
+    }
+
+    size_t size = frame_payload_size(header);
+    ssize_t n = size > 0 ? read_full(fd, buffer->objects + header->offset, size) : 0;
+    if (n != (ssize_t)size) {
+        buffer->next_sequence = 0;
+        if (n == 0) return 0;
+        errno = EPROTO;
+        return -1;
+    }
+    buffer->received += header->count;
+    if (!frame_is_last(header)) {
+        buffer->next_sequence = header->sequence + 1;
+        return FRAME_PARTIAL;
+    }
+    buffer->next_sequence = 0;
+    buffer->header.count = buffer->header.total;
+    buffer->header.offset = 0;
+    return 1;
+}
+
+// Receive one frame in the buffer of its set, as frame_receive
+static int frame_read(int fd, FrameBuffer *buffer) {
+    FrameHeader header;
+    int n = frame_read_header(fd, &header);
+    if (n <= 0) return n;
+    return frame_receive(fd, &header, buffer);
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "repulsion.h"
+
+/**
+ * Uniform grid over the map used to find the objects close to a point.
+ * The objects are sorted by cell (row major) as in a compressed sparse row matrix, so the
+ * objects of consecutive cells of one row are contiguous: a query over a square of cells
+ * is a handful of contiguous runs, which the SIMD kernels can consume without any copy.
+ */
+typedef struct {
+    float cell_size;
+    int cols, rows;
+    int *cell_start;                        // First object of each cell, cols * rows + 1 entries
+    int *index;                             // Position of each sorted object in the original set
+    ObstacleBuffer items;                   // Coordinates of the objects, sorted by cell
+} SpatialGrid;
+
+static inline int grid_clamp(int value, int max) {
+    return value < 0 ? 0 : (value >= max ? max - 1 : value);
+}
+
+static inline int grid_cell(const SpatialGrid *grid, float x, float y) {
+    int col = grid_clamp((int)floorf(x / grid->cell_size), grid->cols);
+    int row = grid_clamp((int)floorf(y / grid->cell_size), grid->rows);
+    return row * grid->cols + col;
+}
+
+static void grid_free(SpatialGrid *grid) {
+    free(grid->cell_start);
+    free(grid->index);
+    obstacle_buffer_free(&grid->items);
+    memset(grid, 0, sizeof(SpatialGrid));
+}
+
+// Build the index of n objects on a map of width x height with a counting sort, O(n + cells)
+static int grid_build(SpatialGrid *grid, const float *x, const float *y, int n, int width, int height, float cell_size) {
+    memset(grid, 0, sizeof(SpatialGrid));
+    grid->cell_size = cell_size;
+    grid->cols = (int)ceilf((width > 1 ? width : 1) / cell_size);
+    grid->rows = (int)ceilf((height > 1 ? height : 1) / cell_size);
+    int cells = grid->cols * grid->rows;
+
+    grid->cell_start = calloc(cells + 1, sizeof(int));
+    grid->index = malloc(sizeof(int) * (n > 0 ? n : 1));
+    int *cell_of = malloc(sizeof(int) * (n > 0 ? n : 1));
+    if (grid->cell_start == NULL || grid->index == NULL || cell_of == NULL || obstacle_buffer_reserve(&grid->items, n) == -1) {
+        free(cell_of);
+        grid_free(grid);
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        cell_of[i] = grid_cell(grid, x[i], y[i]);
+        grid->cell_start[cell_of[i] + 1]++;
+    }
+    for (int c = 0; c < cells; c++) {
+        grid->cell_start[c + 1] += grid->cell_start[c];
+    }
+    // cell_start[c] is used as the insertion point of cell c, then shifted back
+    for (int i = 0; i < n; i++) {
+        int slot = grid->cell_start[cell_of[i]]++;
+        grid->items.x[slot] = x[i];
+        grid->items.y[slot] = y[i];
+        grid->index[slot] = i;
+    }
+    memmove(grid->cell_start + 1, grid->cell_start, sizeof(int) * cells);
+    grid->cell_start[0] = 0;
+    grid->items.count = n;
+
+    free(cell_of);
+    return 0;
+}
+
+/**
+ * Runs of objects in the cells within `radius` of (x, y): one run per row of cells.
+ * Returns the number of rows; first[i] and last[i] delimit the i-th run (last excluded).
+ */
+static int grid_query(const SpatialGrid *grid, float x, float y, float radius, int *first, int *last, int max_runs) {
+    if (grid->items.count == 0) return 0;
+    int col_from = grid_clamp((int)floorf((x - radius) / grid->cell_size), grid->cols);
+    int col_to = grid_clamp((int)floorf((x + radius) / grid->cell_size), grid->cols);
+    int row_from = grid_clamp((int)floorf((y - radius) / grid->cell_size), grid->rows);
+    int row_to = grid_clamp((int)floorf((y + radius) / grid->cell_size), grid->rows);
+
+    int runs = 0;
+    for (int row = row_from; row <= row_to && runs < max_runs; row++) {
+        int begin = grid->cell_start[row * grid->cols + col_from];
+        int end = grid->cell_start[row * grid->cols + col_to + 1];
+        if (begin == end) continue;
+        first[runs] = begin;
+        last[runs] = end;
+        runs++;
+    }
+    return runs;
+}
+
+#endif
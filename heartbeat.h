@@ -0,0 +1,82 @@
+#ifndef HEARTBEAT_H
+#define HEARTBEAT_H
+
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "helper.h"
+
+#define HEARTBEAT_SHARED_MEMORY "/heartbeat_memory" // Name of the shared memory with the heartbeats
+#define HEARTBEAT_MAGIC 0x54424841u         // "AHBT" in little endian
+#define HEARTBEAT_INTERVAL_MS 1000          // Longest wait of a main loop between two beats
+
+/**
+ * Liveness of the processes: every process bumps its slot from its own main loop, the watchdog
+ * reads the time of the last beat and never signals anybody. A process is alive as long as its
+ * loop makes progress, a handler that still runs in a stuck process does not count.
+ * Each slot has its own cache line, so the processes never write to a shared one.
+ */
+typedef struct {
+    atomic_ullong count;                    // Iterations of the main loop
+    atomic_ullong time;                     // Monotonic time (ns) of the last beat, 0 before the first one
+} __attribute__((aligned(64))) HeartbeatSlot;
+
+typedef struct {
+    uint32_t magic;
+    atomic_int watchdog;                    // Pid of the watchdog once it runs, 0 before
+    HeartbeatSlot slots[N_PROCS];           // Indexed by PROC_SERVER to PROC_INPUT
+} Heartbeat;
+
+static inline void heartbeat_beat(Heartbeat *heartbeat, int slot) {
+    if (heartbeat == NULL) return;
+    atomic_fetch_add_explicit(&heartbeat->slots[slot].count, 1, memory_order_relaxed);
+    atomic_store_explicit(&heartbeat->slots[slot].time, monotonic_ns(), memory_order_release);
+}
+
+static inline uint64_t heartbeat_last(Heartbeat *heartbeat, int slot) {
+    return atomic_load_explicit(&heartbeat->slots[slot].time, memory_order_acquire);
+}
+
+// Create an empty page, done once by the main before launching the processes. Returns NULL on errors
+static Heartbeat *heartbeat_create() {
+    shm_unlink(HEARTBEAT_SHARED_MEMORY);
+    int fd = shm_open(HEARTBEAT_SHARED_MEMORY, O_CREAT | O_RDWR, 0666);
+    if (fd == -1) return NULL;
+    if (ftruncate(fd, sizeof(Heartbeat)) == -1) {
+        close(fd);
+        return NULL;
+    }
+    Heartbeat *heartbeat = mmap(0, sizeof(Heartbeat), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (heartbeat == MAP_FAILED) return NULL;
+    heartbeat->magic = HEARTBEAT_MAGIC;
+    return heartbeat;
+}
+
+// Map the page created by the main, returns NULL on errors
+static Heartbeat *heartbeat_open() {
+    int fd = shm_open(HEARTBEAT_SHARED_MEMORY, O_RDWR, 0666);
+    if (fd == -1) return NULL;
+    Heartbeat *heartbeat = mmap(0, sizeof(Heartbeat), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (heartbeat == MAP_FAILED) return NULL;
+    if (heartbeat->magic != HEARTBEAT_MAGIC) {
+        munmap(heartbeat, sizeof(Heartbeat));
+        return NULL;
+    }
+    return heartbeat;
+}
+
+// Sleep until the given monotonic time (ns), beating at least every HEARTBEAT_INTERVAL_MS
+static inline void heartbeat_sleep_until(Heartbeat *heartbeat, int slot, uint64_t deadline) {
+    uint64_t now;
+    while ((now = monotonic_ns()) < deadline) {
+        heartbeat_beat(heartbeat, slot);
+        uint64_t step = deadline - now < HEARTBEAT_INTERVAL_MS * 1000000ULL ? deadline - now : HEARTBEAT_INTERVAL_MS * 1000000ULL;
+        sleep_until_ns(now + step);
+    }
+    heartbeat_beat(heartbeat, slot);
+}
+
+#endif
@@ -4,28 +4,78 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <sys/file.h>
 #include <semaphore.h>
+#include <stdatomic.h>
 #include <time.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "logger.h"
 
 #define BOX_HEIGHT 3                        // Height of the box of each key
 #define BOX_WIDTH 5                         // Width of the box of each key
 #define TIMEOUT 10                          // Number of seconds after which, if a process does not respond, the watchdog terminates all the processes
 #define N_PROCS 5                          // Number of processes of the watchdog
+#define PROC_SERVER 0                       // Index of each process of the watchdog, in its pids, heartbeat slots and readiness reports
+#define PROC_DRONE 1
+#define PROC_OBSTACLE 2
+#define PROC_TARGET 3
+#define PROC_INPUT 4
 #define DRONE_SHARED_MEMORY "/drone_memory" // Name of the shared memory
+#define N_DRONES 1                          // Default number of drones
+#define MAX_DRONES 4096                     // Largest swarm accepted from appsettings.json
+#define DRONES_VARIABLE "ARP_DRONES"        // Environment variable with the number of drones, set by the main from appsettings.json
+#define DRONE_ALL -1                        // Drone of a key meant for the whole swarm
+#define DRONE_SPACING 2                     // Cells between the initial positions of two drones
+#define DRONES_PER_ROW 16                   // Drones on each row of the initial formation
 #define MASS 2                              // Mass (kg) of the drone
 #define FRICTION_COEFFICIENT 0.5            // Friction coefficient of the drone
 #define FORCE_MODULE 1.0                    // Force module
 #define T 0.5                               // Instant of time (dt)
+#define PHYSICS_RATE 20                     // Default number of physics ticks per second
+#define TIME_SCALE (T * PHYSICS_RATE)       // Default simulated seconds per real second, T per tick at PHYSICS_RATE
+#define MAX_CATCH_UP 4                      // Default number of late ticks the physics can run back to back
 #define MAX_FREP 15                         
+#define HEADLESS_FLAG "--headless"          // Run the components without konsole and ncurses
+#define RECORD_FLAG "--record"              // Save the keys sent by the keyboard manager in a journal
+#define REPLAY_FLAG "--replay"              // Send the keys of a journal instead of the keyboard
+#define SEED_FLAG "--seed"                  // World seed of the generators, it overrides the one of appsettings.json
+#define HEADLESS_MAP_WIDTH 200              // Size of the map when there is no terminal to measure
+#define HEADLESS_MAP_HEIGHT 60
+#define MAX_FPS 20                          // Default maximum number of frames per second of the map and the info window
+#define MAX_FPS_VARIABLE "ARP_MAX_FPS"      // Environment variable with the maximum FPS, set by the main from appsettings.json
+#define IDLE_REDRAW_INTERVAL 250000000ULL   // Nanoseconds after which a UI checks for other changes while the drone is still
+#define GENERATION_PERIOD 15                // Default seconds between two generations of obstacles or of targets
+#define OBSTACLES_PERIOD_VARIABLE "ARP_OBSTACLES_PERIOD"      // Environment variables with the periods and the jitter (s) of the generations,
+#define TARGETS_PERIOD_VARIABLE "ARP_TARGETS_PERIOD"          // set by the main from appsettings.json
+#define GENERATION_JITTER_VARIABLE "ARP_GENERATION_JITTER"
+#define GENERATION_REQUEST "regenerate\n"   // Line sent by the server to a generator to ask for a new set
+#define WORLD_TRANSPORT_VARIABLE "ARP_WORLD_TRANSPORT"    // Environment variable with the transport of the sets, set by the main
+#define WORLD_TRANSPORT_STREAM "stream"     // The sets are streamed in chunks through the pipes instead of the world shared memory
 
 typedef struct {
     float pos_x, pos_y;
     float vel_x, vel_y;
     float force_x, force_y;
-    sem_t *sem;
 } Drone;
 
+/**
+ * Shared memory with every drone: a header followed by the states, packed one after the other.
+ * A tick reads and writes all the fields of each drone, so the records are kept whole and
+ * contiguous; the whole swarm is walked front to back without touching any other memory.
+ */
+typedef struct {
+    sem_t *sem;
+    atomic_uint sequence;                   // Seqlock of the states: odd while a writer is updating them
+    atomic_uint waiters;                    // Readers sleeping in swarm_wait
+    int count;                              // Number of drones, fixed by the server
+    Drone drones[] __attribute__((aligned(64)));
+} Swarm;
+
 typedef struct {
     int pos_x, pos_y;
     int point;
@@ -36,30 +86,108 @@ typedef struct {
     int max_x, max_y;
 } Game;
 
-static inline __attribute__((always_inline)) void writeLog(FILE* file, char* message) {
-    char time_now[50];
-    time_t log_time = time(NULL);
-    strftime(time_now, sizeof(time_now), "%Y-%m-%d %H:%M:%S", localtime(&log_time));
-    int lockResult = flock(fileno(file), LOCK_EX);
-    if (lockResult == -1) {
-        perror("Failed to lock the log file");
-        exit(EXIT_FAILURE);
+// Message sent for every key pressed, from the keyboard manager to the drone through the server
+typedef struct {
+    int key;
+    int drone;                              // Index of the drone that receives the key, or DRONE_ALL
+    uint64_t origin;                        // Monotonic time (ns) at which the key was pressed
+} KeyMessage;
+
+// Bytes of the shared memory of a swarm of `count` drones
+static inline size_t swarm_size(int count) {
+    return sizeof(Swarm) + (size_t)count * sizeof(Drone);
+}
+
+/**
+ * The states of the drones in shared memory are published under a seqlock: the writer makes the
+ * sequence odd, updates the fields and makes it even again, the readers copy the fields and
+ * retry if the sequence was odd or changed meanwhile. Readers never block the writer.
+ * Only one writer at a time is allowed, the drone process serializes its threads with a mutex.
+ * A single sequence covers the swarm, so a tick of every drone is published at once.
+ */
+static inline void swarm_write_begin(Swarm *swarm) {
+    atomic_fetch_add_explicit(&swarm->sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+// Wake the readers sleeping on the sequence, the system call is skipped when nobody waits
+static inline void swarm_wake(Swarm *swarm) {
+    if (atomic_load_explicit(&swarm->waiters, memory_order_seq_cst) > 0) {
+        syscall(SYS_futex, &swarm->sequence, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
     }
-    
-    fprintf(file,"[%s] => %s\n", time_now, message);
-    fflush(file);
-
-    int unlockResult = flock(fileno(file), LOCK_UN);
-    if (unlockResult == -1) {
-        perror("Failed to unlock the log file");
-        exit(EXIT_FAILURE);
+}
+
+static inline void swarm_write_end(Swarm *swarm) {
+    atomic_fetch_add_explicit(&swarm->sequence, 1, memory_order_seq_cst);
+    swarm_wake(swarm);
+}
+
+// Version of the published states, it changes every time the writer updates them
+static inline unsigned int swarm_version(Swarm *swarm) {
+    return atomic_load_explicit(&swarm->sequence, memory_order_acquire) & ~1u;
+}
+
+/**
+ * Sleep until the published version differs from `version`, or at most timeout_ns (0 waits
+ * without limit). Returns the current version. The sleep is a futex on the sequence itself,
+ * so the reader costs nothing while the swarm is still and wakes as soon as it is published.
+ */
+static inline unsigned int swarm_wait(Swarm *swarm, unsigned int version, uint64_t timeout_ns) {
+    atomic_fetch_add_explicit(&swarm->waiters, 1, memory_order_seq_cst);
+    unsigned int current = atomic_load_explicit(&swarm->sequence, memory_order_seq_cst);
+    if ((current & ~1u) == version) {
+        struct timespec timeout = {timeout_ns / 1000000000ULL, timeout_ns % 1000000000ULL};
+        syscall(SYS_futex, &swarm->sequence, FUTEX_WAIT, current, timeout_ns > 0 ? &timeout : NULL, NULL, 0);
     }
+    atomic_fetch_sub_explicit(&swarm->waiters, 1, memory_order_relaxed);
+    return swarm_version(swarm);
+}
+
+// Minimum nanoseconds between two frames of a UI, from the maximum FPS given by the main
+static inline uint64_t frame_interval_ns() {
+    const char *value = getenv(MAX_FPS_VARIABLE);
+    double fps = value != NULL ? atof(value) : MAX_FPS;
+    if (fps <= 0) fps = MAX_FPS;
+    return (uint64_t)(1e9 / fps);
+}
+
+// Sleep until the given monotonic time (ns)
+static inline void sleep_until_ns(uint64_t deadline) {
+    struct timespec until = {deadline / 1000000000ULL, deadline % 1000000000ULL};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+// Copy a consistent snapshot of every drone into `snapshot`, which holds swarm->count states, and return its version
+static inline unsigned int swarm_read(Swarm *swarm, Drone *snapshot) {
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&swarm->sequence, memory_order_acquire);
+        if (before & 1) continue;
+        memcpy(snapshot, swarm->drones, (size_t)swarm->count * sizeof(Drone));
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&swarm->sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    return before;
+}
+
+// Current value of the monotonic clock in nanoseconds
+static inline uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
 }
 
 #define LOG_TO_FILE(file, message) {                                                                                \
-    char log[4096];                                                                                                 \
-    sprintf(log, "Generated at line [%d] by [%s] with the following message: %s", __LINE__, __FILE__, message);     \
-    writeLog(file, log);                                                                                            \
+    static int log_site;                                                                                            \
+    log_push(file, &log_site, __LINE__, __FILE__, message);                                                         \
+}
+
+// Log a literal format with integer arguments, formatted by the writer instead of the caller
+#define LOG_EVENT(file, format, ...) {                                                                              \
+    static int log_site;                                                                                            \
+    const int64_t log_arguments[] = {0, ##__VA_ARGS__};                                                             \
+    log_push_event(file, &log_site, __LINE__, __FILE__, "" format, log_arguments + 1,                               \
+                   sizeof(log_arguments) / sizeof(int64_t) - 1);                                                    \
 }
 
 #endif
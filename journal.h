@@ -0,0 +1,64 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define JOURNAL_MAGIC 0x4b505241u           // "ARPK" in little endian
+#define JOURNAL_VERSION 1
+
+/**
+ * Binary journal of the keys sent by the keyboard manager: a JournalHeader followed by one
+ * JournalRecord per key, in the order they were sent. The times are relative to the start of
+ * the recording, so a journal can be replayed at any moment and at any speed.
+ */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t reserved;
+    uint64_t start;                         // Monotonic time (ns) of the start of the recording, for reference only
+} JournalHeader;
+
+typedef struct __attribute__((packed)) {
+    uint64_t time;                          // Nanoseconds since the start of the recording
+    int32_t key;
+} JournalRecord;
+
+// Create a journal and write its header, returns NULL on errors
+static FILE *journal_create(const char *path, uint64_t start) {
+    FILE *journal = fopen(path, "wb");
+    if (journal == NULL) return NULL;
+    JournalHeader header = {JOURNAL_MAGIC, JOURNAL_VERSION, 0, start};
+    if (fwrite(&header, sizeof(header), 1, journal) != 1) {
+        fclose(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+// Append a key, flushed at once so that a killed session keeps everything sent so far
+static int journal_append(FILE *journal, uint64_t time, int key) {
+    JournalRecord record = {time, key};
+    if (fwrite(&record, sizeof(record), 1, journal) != 1) return -1;
+    return fflush(journal);
+}
+
+// Open a journal and check its header, returns NULL on errors
+static FILE *journal_open(const char *path, JournalHeader *header) {
+    FILE *journal = fopen(path, "rb");
+    if (journal == NULL) return NULL;
+    if (fread(header, sizeof(*header), 1, journal) != 1 || header->magic != JOURNAL_MAGIC ||
+        header->version != JOURNAL_VERSION) {
+        fclose(journal);
+        return NULL;
+    }
+    return journal;
+}
+
+// Read the next key, returns 0 at the end of the journal
+static int journal_next(FILE *journal, JournalRecord *record) {
+    return fread(record, sizeof(*record), 1, journal) == 1;
+}
+
+#endif
@@ -6,12 +6,20 @@
 #include <unistd.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <pthread.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/resource.h>
 #include "helper.h"
+#include "journal.h"
+#include "ready.h"
+#include "heartbeat.h"
 
 WINDOW *input_window, *info_window, *windows[3][3]; 
 FILE *debug, *errors;                               // File descriptors for the two log files
-Drone *drone;
+Swarm *swarm;
+Heartbeat *heartbeat;
 pid_t wd_pid;
 const char *symbols[3][3] = {                       // Symbols for the keyboard
     {"\\", "^", "/"},
@@ -19,12 +27,21 @@ const char *symbols[3][3] = {                       // Symbols for the keyboard
     {"/", "v", "\\"}
 };
 pthread_mutex_t info_window_mutex;                  // Mutex for synchronizing ncurses
+volatile int info_window_dirty = 1;                 // Set when the info window must be redrawn even if the drone did not change
+FILE *journal = NULL;                               // Journal of the keys sent, when recording
+uint64_t journal_start;
+atomic_int selected_drone = 0;                      // Drone that receives the keys, or DRONE_ALL
 
-// Update the information window
-void update_info_window() {
+// Update the information window with a consistent snapshot of the selected drone
+void update_info_window(Drone *state, int selected) {
     werase(info_window);
     box(info_window, 0, 0);
     mvwprintw(info_window, 0, 2, "Info display");
+    if (selected == DRONE_ALL) {
+        mvwprintw(info_window, 1, 2, "All %d drones, showing drone 0", swarm->count);
+    } else {
+        mvwprintw(info_window, 1, 2, "Drone %d of %d", selected, swarm->count);
+    }
 
     int rows, cols;
     getmaxyx(stdscr, rows, cols);
@@ -32,29 +49,45 @@ void update_info_window() {
     int middle_col = cols / 4;
     int middle_row = rows / 4;
     mvwprintw(info_window, middle_row - 2, middle_col - 7, "position {");
-    mvwprintw(info_window, middle_row - 1, middle_col - 6, "x: %.6f", drone->pos_x);
-    mvwprintw(info_window, middle_row, middle_col - 6, "y: %.6f", drone->pos_y);
+    mvwprintw(info_window, middle_row - 1, middle_col - 6, "x: %.6f", state->pos_x);
+    mvwprintw(info_window, middle_row, middle_col - 6, "y: %.6f", state->pos_y);
     mvwprintw(info_window, middle_row + 1, middle_col - 7, "}");
 
     mvwprintw(info_window, middle_row + 3, middle_col - 7, "velocity {");
-    mvwprintw(info_window, middle_row + 4, middle_col - 6, "x: %.6f", drone->vel_x);
-    mvwprintw(info_window, middle_row + 5, middle_col - 6, "y: %.6f", drone->vel_y);
+    mvwprintw(info_window, middle_row + 4, middle_col - 6, "x: %.6f", state->vel_x);
+    mvwprintw(info_window, middle_row + 5, middle_col - 6, "y: %.6f", state->vel_y);
     mvwprintw(info_window, middle_row + 6, middle_col - 7, "}");
 
     mvwprintw(info_window, middle_row + 8, middle_col - 7, "force {");
-    mvwprintw(info_window, middle_row + 9, middle_col - 6, "x: %.6f", drone->force_x);
-    mvwprintw(info_window, middle_row + 10, middle_col - 6, "y: %.6f", drone->force_y);
+    mvwprintw(info_window, middle_row + 9, middle_col - 6, "x: %.6f", state->force_x);
+    mvwprintw(info_window, middle_row + 10, middle_col - 6, "y: %.6f", state->force_y);
     mvwprintw(info_window, middle_row + 11, middle_col - 7, "}");
     wrefresh(info_window);
 }
 
-// Routine for continuously updating the information window
+// Routine for updating the information window every time the swarm is published, at most at the maximum FPS
 void *update_info_thread() {
+    uint64_t interval = frame_interval_ns(), last_frame = 0;
+    unsigned int last_version = 1;          // Odd, so it never matches a published version
+    Drone *states = malloc(sizeof(Drone) * swarm->count);
+    if (states == NULL) {
+        perror("Error allocating the snapshot of the swarm");
+        LOG_TO_FILE(errors, "Error allocating the snapshot of the swarm");
+        return NULL;
+    }
     while (1) {
-        pthread_mutex_lock(&info_window_mutex);
-        update_info_window();
-        pthread_mutex_unlock(&info_window_mutex);
-        usleep(50000);
+        // Sleep until the swarm changes, a resize or a new selection is noticed within IDLE_REDRAW_INTERVAL
+        swarm_wait(swarm, last_version, IDLE_REDRAW_INTERVAL);
+        if (swarm_version(swarm) != last_version || info_window_dirty) {
+            if (monotonic_ns() < last_frame + interval) sleep_until_ns(last_frame + interval);
+            last_frame = monotonic_ns();
+            last_version = swarm_read(swarm, states);
+            info_window_dirty = 0;
+            int selected = atomic_load(&selected_drone);
+            pthread_mutex_lock(&info_window_mutex);
+            update_info_window(&states[selected == DRONE_ALL ? 0 : selected], selected);
+            pthread_mutex_unlock(&info_window_mutex);
+        }
     }
 }
 
@@ -80,6 +113,7 @@ void handle_key_pressed(WINDOW *win, const char *symbol) {
 void create_keyboard_window(int rows, int cols) {
     input_window = newwin(rows, cols / 2, 0, 0);
     info_window = newwin(rows, cols / 2, 0, cols / 2);
+    info_window_dirty = 1;
 
     int start_y = (rows - (BOX_HEIGHT * 3)) / 2;
     int start_x = ((cols / 2) - (BOX_WIDTH * 3 )) / 2;
@@ -94,6 +128,7 @@ void create_keyboard_window(int rows, int cols) {
 
     box(input_window, 0, 0);
     mvwprintw(input_window, 0, 2, "Input manager");
+    mvwprintw(input_window, rows - 3, ((cols / 2) - 36) / 2, "Press 'N' to select the next drone");
     mvwprintw(input_window, rows - 2, ((cols / 2) - 30) / 2, "Press 'P' to close the program");
     wrefresh(input_window);
 }
@@ -116,15 +151,25 @@ void resize_windows() {
     create_keyboard_window(rows, cols);
 }
 
+/**
+ * Log the exit code and the resources used by this process. Under konsole the main reaps the
+ * terminal, not the keyboard manager, so this is the only record of how it ended. Registered
+ * after the log writer, so it runs before the last flush. A process killed by a signal logs nothing.
+ */
+void log_own_exit(int status, void *data) {
+    struct rusage usage;
+    char message[256];
+    if (getrusage(RUSAGE_SELF, &usage) == -1) return;
+    snprintf(message, sizeof(message), "The keyboard manager [%d] exits with status %d, user %ld.%03ld s, system %ld.%03ld s, max RSS %ld kB",
+             getpid(), status, (long)usage.ru_utime.tv_sec, (long)usage.ru_utime.tv_usec / 1000,
+             (long)usage.ru_stime.tv_sec, (long)usage.ru_stime.tv_usec / 1000, usage.ru_maxrss);
+    LOG_TO_FILE(status == 0 ? debug : errors, message);
+}
+
 void signal_handler(int sig, siginfo_t* info, void *context) {
     if (sig == SIGWINCH) {
         resize_windows();
     }
-    if (sig == SIGUSR1) {
-        wd_pid = info->si_pid;
-        LOG_TO_FILE(debug, "Signal SIGUSR1 received from WATCHDOG");
-        kill(wd_pid, SIGUSR1);
-    }
     if (sig == SIGUSR2){
         LOG_TO_FILE(debug, "Shutting down by the WATCHDOG");
 
@@ -146,7 +191,7 @@ void signal_handler(int sig, siginfo_t* info, void *context) {
 }
 
 int open_shared_memory() {
-    int mem_fd = shm_open(DRONE_SHARED_MEMORY, O_RDONLY, 0666);
+    int mem_fd = shm_open(DRONE_SHARED_MEMORY, O_RDWR, 0666);
     if (mem_fd == -1) {
         perror("Error opening the shared memory");
         LOG_TO_FILE(errors, "Error opening the shared memory");
@@ -155,8 +200,10 @@ int open_shared_memory() {
         fclose(errors);   
         exit(EXIT_FAILURE);
     }
-    drone = (Drone *)mmap(0, sizeof(Drone), PROT_READ, MAP_SHARED, mem_fd, 0);
-    if (drone == MAP_FAILED) {
+    // Writable only to register as a waiter of the state, the segment is sized by the server for its number of drones
+    struct stat info;
+    swarm = fstat(mem_fd, &info) == -1 ? MAP_FAILED : (Swarm *)mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (swarm == MAP_FAILED) {
         perror("Error mapping the shared memory");
         LOG_TO_FILE(errors, "Error mapping the shared memory");
         // Close the files
@@ -167,11 +214,164 @@ int open_shared_memory() {
     return mem_fd;
 }
 
+// Select the next drone, after the last one the keys go to the whole swarm
+void select_next_drone() {
+    int selected = atomic_load(&selected_drone);
+    if (selected == DRONE_ALL) {
+        selected = 0;
+    } else if (++selected == swarm->count) {
+        selected = swarm->count > 1 ? DRONE_ALL : 0;
+    }
+    atomic_store(&selected_drone, selected);
+    info_window_dirty = 1;
+
+    if (selected == DRONE_ALL) {
+        LOG_TO_FILE(debug, "Selected all the drones");
+    } else {
+        LOG_EVENT(debug, "Selected the drone %d", selected);
+    }
+}
+
+/**
+ * Send a key to the server for the selected drone, stamped so that every hop towards the drone
+ * can measure its latency. The selection key is handled here and only recorded in the journal,
+ * so a replay selects the same drones.
+ */
+void send_key(int server_write_fd, int key) {
+    KeyMessage message = {key, atomic_load(&selected_drone), monotonic_ns()};
+    if (key == 'n' || key == 'N') {
+        select_next_drone();
+    } else {
+        write(server_write_fd, &message, sizeof(message));
+    }
+    if (journal != NULL && journal_append(journal, message.origin - journal_start, key) == -1) {
+        LOG_TO_FILE(errors, "Error writing the key journal");
+    }
+}
+
+// Nothing left to send: keep beating until the game is closed
+void idle_until_closed() {
+    while (1) {
+        heartbeat_sleep_until(heartbeat, PROC_INPUT, monotonic_ns() + HEARTBEAT_INTERVAL_MS * 1000000ULL);
+    }
+}
+
+// Close the journal, the quit key is recorded too so that a replay ends at the same moment
+void end_recording() {
+    if (journal == NULL) return;
+    journal_append(journal, monotonic_ns() - journal_start, 'p');
+    fclose(journal);
+    journal = NULL;
+}
+
+/**
+ * Send the keys of a journal with their original timing divided by speed,
+ * or as fast as possible when speed is 0.
+ */
+void replay_manager(int server_write_fd, const char *path, double speed) {
+    JournalHeader header;
+    JournalRecord record;
+    FILE *replay = journal_open(path, &header);
+    if (replay == NULL) {
+        perror("Error opening the key journal");
+        LOG_TO_FILE(errors, "Error opening the key journal");
+        return;
+    }
+
+    uint64_t start = monotonic_ns();
+    while (journal_next(replay, &record)) {
+        if (speed > 0) {
+            heartbeat_sleep_until(heartbeat, PROC_INPUT, start + (uint64_t)(record.time / speed));
+        }
+        if (record.key == 'p' || record.key == 'P') {
+            fclose(replay);
+            return;
+        }
+        send_key(server_write_fd, record.key);
+    }
+    fclose(replay);
+
+    LOG_TO_FILE(debug, "End of the key journal");
+    idle_until_closed();
+}
+
+// Play one line of a script, returns 0 when it is the quit key
+int script_line(int server_write_fd, const char *line) {
+    char key;
+    int delay = 0;
+    if (line[0] == '#' || sscanf(line, " %c %d", &key, &delay) < 1) return 1;
+    if (key == 'p' || key == 'P') return 0;
+    send_key(server_write_fd, key);
+    if (delay > 0) heartbeat_sleep_until(heartbeat, PROC_INPUT, monotonic_ns() + delay * 1000000ULL);
+    return 1;
+}
+
+/**
+ * Send the keys of a script instead of the keyboard. Every line holds a key and optionally the
+ * milliseconds to wait after sending it, lines starting with '#' are comments.
+ * A FIFO is reopened every time its writer closes it, a regular file is played once.
+ * The script is read with poll, so the process keeps beating while a FIFO has no writer.
+ */
+void script_manager(int server_write_fd, const char *path) {
+    char buffer[256];
+    while (1) {
+        // A FIFO opened without O_NONBLOCK would block until its writer arrives
+        int fd = open(path, O_RDONLY | O_NONBLOCK);
+        if (fd == -1) {
+            perror("Error opening the key script");
+            LOG_TO_FILE(errors, "Error opening the key script");
+            return;
+        }
+        struct stat info;
+        int fifo = fstat(fd, &info) == 0 && S_ISFIFO(info.st_mode);
+
+        size_t length = 0;                  // Bytes of an incomplete line at the start of the buffer
+        while (1) {
+            heartbeat_beat(heartbeat, PROC_INPUT);
+            struct pollfd entry = {fd, POLLIN, 0};
+            if (poll(&entry, 1, HEARTBEAT_INTERVAL_MS) <= 0) continue;
+            ssize_t bytes_read = read(fd, buffer + length, sizeof(buffer) - 1 - length);
+            if (bytes_read == -1 && (errno == EAGAIN || errno == EINTR)) continue;
+            // End of the file, or the writer of the FIFO has closed it
+            if (bytes_read <= 0) break;
+
+            length += bytes_read;
+            buffer[length] = '\0';
+            char *line = buffer, *end;
+            while ((end = strchr(line, '\n')) != NULL) {
+                *end = '\0';
+                if (!script_line(server_write_fd, line)) {
+                    close(fd);
+                    return;
+                }
+                line = end + 1;
+            }
+            length -= line - buffer;
+            if (length == sizeof(buffer) - 1) length = 0;
+            memmove(buffer, line, length);
+        }
+        // The last line may have no newline
+        buffer[length] = '\0';
+        if (length > 0 && !script_line(server_write_fd, buffer)) {
+            close(fd);
+            return;
+        }
+        close(fd);
+        if (!fifo) break;
+    }
+
+    LOG_TO_FILE(debug, "End of the key script");
+    idle_until_closed();
+}
+
 void keyboard_manager(int server_write_fd) {
     int ch;
+    // getch waits at most HEARTBEAT_INTERVAL_MS, then the loop beats again
+    heartbeat_beat(heartbeat, PROC_INPUT);
     while ((ch = getch()) != 'p' && ch != 'P') {
-        if (ch != EOF) {
-            write(server_write_fd, &ch, sizeof(ch));
+        heartbeat_beat(heartbeat, PROC_INPUT);
+        if (ch != ERR) {
+            send_key(server_write_fd, ch);
         }
     }
 }
@@ -188,6 +388,9 @@ int main(int argc, char* argv[]) {
         perror("Error opening the errors file");
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
+    on_exit(log_own_exit, NULL);
 
     if (argc < 2) {
         LOG_TO_FILE(errors, "Invalid number of parameters");
@@ -205,19 +408,63 @@ int main(int argc, char* argv[]) {
     /* OPEN SHARED MEMORY */
     int mem_fd = open_shared_memory();
 
-    /* SETUP NCURSE */
-    initscr();
-    start_color();
-    cbreak();
-    noecho();
-    curs_set(0);
-
-    init_pair(1, COLOR_WHITE, COLOR_BLACK);
-    init_pair(2, COLOR_BLACK, COLOR_GREEN);
+    /* OPEN THE HEARTBEAT */
+    heartbeat = heartbeat_open();
+    if (heartbeat == NULL) {
+        perror("Error opening the heartbeat shared memory");
+        LOG_TO_FILE(errors, "Error opening the heartbeat shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
+    heartbeat_beat(heartbeat, PROC_INPUT);
+
+    /* READ THE OPTIONS */
+    // --headless <script> and --replay <journal> [speed] replace the keyboard, --record <journal> saves the keys sent
+    const char *script_path = NULL, *replay_path = NULL, *record_path = NULL;
+    double replay_speed = 1.0;
+    for (int i = 2; i < argc - 1; i++) {
+        if (strcmp(argv[i], HEADLESS_FLAG) == 0) {
+            script_path = argv[++i];
+        } else if (strcmp(argv[i], REPLAY_FLAG) == 0) {
+            replay_path = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-') replay_speed = atof(argv[++i]);
+        } else if (strcmp(argv[i], RECORD_FLAG) == 0) {
+            record_path = argv[++i];
+        }
+    }
+    if (record_path != NULL) {
+        journal_start = monotonic_ns();
+        journal = journal_create(record_path, journal_start);
+        if (journal == NULL) {
+            perror("Error creating the key journal");
+            LOG_TO_FILE(errors, "Error creating the key journal");
+            // Close the files
+            fclose(debug);
+            fclose(errors); 
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
-    create_keyboard_window(rows, cols);
+    /* SETUP NCURSE */
+    // Without the keyboard no terminal is used
+    int headless = script_path != NULL || replay_path != NULL;
+    if (!headless) {
+        initscr();
+        start_color();
+        cbreak();
+        noecho();
+        curs_set(0);
+        timeout(HEARTBEAT_INTERVAL_MS);
+
+        init_pair(1, COLOR_WHITE, COLOR_BLACK);
+        init_pair(2, COLOR_BLACK, COLOR_GREEN);
+
+        int rows, cols;
+        getmaxyx(stdscr, rows, cols);
+        create_keyboard_window(rows, cols);
+    }
 
     /* SETUP SIGNALS */
     struct sigaction sa;
@@ -234,15 +481,6 @@ int main(int argc, char* argv[]) {
         fclose(errors);   
         exit(EXIT_FAILURE);
     }
-    // Set the signal handler for SIGUSR1
-    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
-        perror("Error in sigaction(SIGURS1)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS1)");
-        // Close the files
-        fclose(debug);
-        fclose(errors);   
-        exit(EXIT_FAILURE);
-    }
     // Set the signal handler for SIGUSR2
     if(sigaction(SIGUSR2, &sa, NULL) == -1){
         perror("rror in sigaction(SIGURS2)");
@@ -252,40 +490,59 @@ int main(int argc, char* argv[]) {
         fclose(errors);   
         exit(EXIT_FAILURE);
     }
-    
-    /* START THREAD */
-    // Initialize and create the thread to continuously update the information window
-    pthread_mutex_init(&info_window_mutex, NULL);
-    pthread_t info_thread;
-    if (pthread_create(&info_thread, NULL, update_info_thread, NULL) != 0) {
-        perror("Error creating the thread for update the info window");
-        LOG_TO_FILE(errors, "Error creating the thread for update the info window");
-        // Close the files
-        fclose(debug);
-        fclose(errors);   
-        exit(EXIT_FAILURE);
+
+    /* REPORT TO THE LAUNCHER */
+    if (ready_notify(PROC_INPUT) == -1) {
+        perror("Error reporting to the launcher");
+        LOG_TO_FILE(errors, "Error reporting to the launcher");
     }
 
     /* LAUNCH THE INPUT PROCESS */
-    keyboard_manager(server_write_fd);
+    pthread_t info_thread;
+    if (replay_path != NULL) {
+        replay_manager(server_write_fd, replay_path, replay_speed);
+    } else if (script_path != NULL) {
+        script_manager(server_write_fd, script_path);
+    } else {
+        // Initialize and create the thread to continuously update the information window
+        pthread_mutex_init(&info_window_mutex, NULL);
+        if (pthread_create(&info_thread, NULL, update_info_thread, NULL) != 0) {
+            perror("Error creating the thread for update the info window");
+            LOG_TO_FILE(errors, "Error creating the thread for update the info window");
+            // Close the files
+            fclose(debug);
+            fclose(errors);   
+            exit(EXIT_FAILURE);
+        }
+
+        keyboard_manager(server_write_fd);
+    }
 
     /* END PROGRAM */
+    end_recording();
+
+    // The watchdog publishes its pid once it runs, a script can end before it
+    while ((wd_pid = atomic_load(&heartbeat->watchdog)) == 0) {
+        heartbeat_sleep_until(heartbeat, PROC_INPUT, monotonic_ns() + 10000000ULL);
+    }
     // Send the termination signal to the watchdog
     kill(wd_pid, SIGUSR2);
 
-    // Join the thread and destroy the mutex
-    pthread_join(info_thread, NULL);
-    pthread_mutex_destroy(&info_window_mutex);
+    if (!headless) {
+        // Join the thread and destroy the mutex
+        pthread_join(info_thread, NULL);
+        pthread_mutex_destroy(&info_window_mutex);
 
-    // Delete all the windows
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 3; j++) {
-            delwin(windows[i][j]);
+        // Delete all the windows
+        for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+                delwin(windows[i][j]);
+            }
         }
+        delwin(input_window);
+        delwin(info_window);
+        endwin();
     }
-    delwin(input_window);
-    delwin(info_window);
-    endwin();
 
     // Close the file descriptor
     if (close(mem_fd) == -1) {
@@ -297,7 +554,7 @@ int main(int argc, char* argv[]) {
         exit(EXIT_FAILURE);
     }
     // Unmap the shared memory region
-    munmap(drone, sizeof(Drone));
+    munmap(swarm, swarm_size(swarm->count));
 
     // Close the files
     fclose(debug);
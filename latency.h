@@ -0,0 +1,87 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <signal.h>
+#include <stdatomic.h>
+
+#define LATENCY_SUB_BITS 4                                  // Each power of two is split in 2^4 buckets (~6% precision)
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS)
+#define LATENCY_DUMP_SIGNAL SIGRTMIN                        // Signal asking a process to log its histograms
+
+/**
+ * HDR style histogram of latencies in nanoseconds: values below 2^5 have their own bucket,
+ * above that every power of two is divided in LATENCY_SUB_BUCKETS linear buckets.
+ * Recording is wait free, so it can be done from any thread while another one dumps it.
+ */
+typedef struct {
+    const char *name;
+    atomic_ullong count, sum, min, max;
+    atomic_ullong buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+#define LATENCY_HISTOGRAM(label) { .name = label, .min = UINT64_MAX }
+
+static inline int latency_bucket(uint64_t value) {
+    if (value < 2 * LATENCY_SUB_BUCKETS) return (int)value;
+    int exponent = 63 - __builtin_clzll(value) - LATENCY_SUB_BITS;
+    return exponent * LATENCY_SUB_BUCKETS + (int)(value >> exponent);
+}
+
+// Smallest value that falls in the bucket
+static inline uint64_t latency_bucket_value(int bucket) {
+    int exponent = bucket / LATENCY_SUB_BUCKETS - 1;
+    if (exponent < 0) exponent = 0;
+    return (uint64_t)(bucket - exponent * LATENCY_SUB_BUCKETS) << exponent;
+}
+
+static inline void latency_record(LatencyHistogram *histogram, uint64_t value) {
+    atomic_fetch_add_explicit(&histogram->buckets[latency_bucket(value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->sum, value, memory_order_relaxed);
+
+    unsigned long long current = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > current && !atomic_compare_exchange_weak(&histogram->max, &current, value));
+    current = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+    while (value < current && !atomic_compare_exchange_weak(&histogram->min, &current, value));
+}
+
+// Value below which the given fraction of the samples falls
+static uint64_t latency_percentile(LatencyHistogram *histogram, double fraction) {
+    unsigned long long count = atomic_load(&histogram->count);
+    if (count == 0) return 0;
+    unsigned long long wanted = (unsigned long long)(fraction * count + 0.5);
+    if (wanted == 0) wanted = 1;
+    unsigned long long seen = 0;
+    int i;
+    for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen >= wanted) break;
+    }
+    // The upper bound of the bucket, but never above the largest sample
+    uint64_t value = latency_bucket_value(i + 1) - 1;
+    uint64_t max = atomic_load(&histogram->max);
+    return value < max ? value : max;
+}
+
+// Write a one line summary (values in microseconds) of the histogram in the buffer
+static void latency_format(LatencyHistogram *histogram, char *buffer, size_t size) {
+    unsigned long long count = atomic_load(&histogram->count);
+    if (count == 0) {
+        snprintf(buffer, size, "Latency [%s]: no samples", histogram->name);
+        return;
+    }
+    snprintf(buffer, size, "Latency [%s]: n=%llu min=%.1fus mean=%.1fus p50=%.1fus p90=%.1fus p99=%.1fus p99.9=%.1fus max=%.1fus",
+             histogram->name, count,
+             atomic_load(&histogram->min) / 1e3,
+             (double)atomic_load(&histogram->sum) / count / 1e3,
+             latency_percentile(histogram, 0.50) / 1e3,
+             latency_percentile(histogram, 0.90) / 1e3,
+             latency_percentile(histogram, 0.99) / 1e3,
+             latency_percentile(histogram, 0.999) / 1e3,
+             atomic_load(&histogram->max) / 1e3);
+}
+
+#endif
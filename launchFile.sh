@@ -52,4 +52,18 @@ if [ $? -eq 0 ]; then
         echo "Compilazione di target.c completata con successo"
     else
         echo "Errore durante la compilazione di target.c"
-    fi
\ No newline at end of file
+    fi
+
+cc -o "arp-tracedump" "tracedump.c"
+if [ $? -eq 0 ]; then
+        echo "Compilazione di tracedump.c completata con successo"
+    else
+        echo "Errore durante la compilazione di tracedump.c"
+    fi
+
+cc -O2 -o "physics_bench" "physics_bench.c" -lm
+if [ $? -eq 0 ]; then
+        echo "Compilazione di physics_bench.c completata con successo"
+    else
+        echo "Errore durante la compilazione di physics_bench.c"
+    fi
@@ -0,0 +1,397 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <time.h>
+#include "trace.h"
+
+#define LOG_RING_SIZE 1024                  // Number of records in the ring of each process (must be a power of two)
+#define LOG_MESSAGE_SIZE 1024               // Maximum length of a logged message, longer messages are truncated
+#define LOG_BATCH_SIZE 65536                // Size of the buffer in which the writer batches the records of one file
+#define LOG_MAX_STREAMS 2                   // Number of log files handled by the writer (debug and errors)
+#define LOG_FLUSH_INTERVAL 10000000L        // Nanoseconds the writer sleeps when the ring is empty
+#define LOG_FORMAT_VARIABLE "ARP_LOG_FORMAT" // Environment variable selecting the format ("text" or "binary")
+
+/**
+ * One slot of the ring. The sequence number tells whether the slot is free for the producers
+ * (sequence == position) or ready for the writer (sequence == position + 1).
+ */
+typedef struct {
+    atomic_size_t sequence;
+    int stream;
+    int site;
+    int line;
+    const char *source;
+    uint64_t time;                          // CLOCK_MONOTONIC timestamp in nanoseconds
+    const char *format;                     // Format of a LOG_EVENT, NULL when the message is already formatted
+    int n_arguments;
+    int64_t arguments[LOG_MAX_ARGUMENTS];
+    char message[LOG_MESSAGE_SIZE];
+} LogRecord;
+
+typedef struct {
+    FILE *file;                             // Stream used by the callers of LOG_TO_FILE
+    int fd;                                 // Private copy of the descriptor, still valid after fclose()
+    int binary;                             // Write the records in the binary trace format
+    size_t length;                          // Bytes waiting in the batch
+    unsigned char sites[LOG_MAX_SITES / 8]; // Call sites already described in the trace
+    char batch[LOG_BATCH_SIZE];
+} LogStream;
+
+static LogRecord log_ring[LOG_RING_SIZE];
+static LogStream log_streams[LOG_MAX_STREAMS];
+static atomic_int log_n_streams;
+static atomic_size_t log_head, log_tail;
+static atomic_size_t log_dropped;           // Records lost because the ring was full
+static atomic_int log_draining;             // Set while someone is emptying the ring
+static atomic_int log_n_sites;              // Call site ids handed out so far
+static int64_t log_clock_offset;            // Wall clock minus monotonic clock, in nanoseconds
+
+static inline __attribute__((always_inline)) void writeLog(FILE* file, char* message) {
+    char time_now[50];
+    time_t log_time = time(NULL);
+    strftime(time_now, sizeof(time_now), "%Y-%m-%d %H:%M:%S", localtime(&log_time));
+    int lockResult = flock(fileno(file), LOCK_EX);
+    if (lockResult == -1) {
+        perror("Failed to lock the log file");
+        exit(EXIT_FAILURE);
+    }
+
+    fprintf(file,"[%s] => %s\n", time_now, message);
+    fflush(file);
+
+    int unlockResult = flock(fileno(file), LOCK_UN);
+    if (unlockResult == -1) {
+        perror("Failed to unlock the log file");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Write on disk what has been batched for the stream, one write() per batch
+static void log_stream_flush(LogStream *stream) {
+    if (stream->length == 0) return;
+    flock(stream->fd, LOCK_EX);
+    size_t written = 0;
+    while (written < stream->length) {
+        ssize_t n = write(stream->fd, stream->batch + written, stream->length - written);
+        if (n <= 0) break;
+        written += n;
+    }
+    flock(stream->fd, LOCK_UN);
+    stream->length = 0;
+}
+
+// Append a formatted line to the batch of the stream
+static void log_stream_append(LogStream *stream, const char *line, size_t length) {
+    if (stream->length + length > LOG_BATCH_SIZE) log_stream_flush(stream);
+    if (length > LOG_BATCH_SIZE) length = LOG_BATCH_SIZE;
+    memcpy(stream->batch + stream->length, line, length);
+    stream->length += length;
+}
+
+static uint64_t log_monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Append a binary record to the batch of the stream
+static void log_stream_append_trace(LogStream *stream, int kind, int site, uint64_t time, const void *payload, size_t length,
+                                    const void *extra, size_t extra_length) {
+    char record[sizeof(TraceHeader) + LOG_MESSAGE_SIZE + 256];
+    if (length > LOG_MESSAGE_SIZE) length = LOG_MESSAGE_SIZE;
+    if (extra_length > 256) extra_length = 256;
+    TraceHeader header = {kind, 0, length + extra_length, getpid(), site, time};
+    memcpy(record, &header, sizeof(header));
+    memcpy(record + sizeof(header), payload, length);
+    memcpy(record + sizeof(header) + length, extra, extra_length);
+    log_stream_append(stream, record, sizeof(header) + length + extra_length);
+}
+
+// Describe the clock of this process at the beginning of its part of the trace
+static void log_stream_start_trace(LogStream *stream) {
+    memset(stream->sites, 0, sizeof(stream->sites));
+    log_stream_append_trace(stream, TRACE_CLOCK, 0, log_monotonic_ns(), &log_clock_offset, sizeof(log_clock_offset), NULL, 0);
+}
+
+// Local time of a monotonic timestamp, formatted once per second instead of once per record
+static const char *log_time_text(uint64_t time) {
+    static time_t cached_second = -1;
+    static char cached_time[50];
+    time_t second = (time + log_clock_offset) / 1000000000LL;
+    if (second != cached_second) {
+        struct tm local;
+        localtime_r(&second, &local);
+        strftime(cached_time, sizeof(cached_time), "%Y-%m-%d %H:%M:%S", &local);
+        cached_second = second;
+    }
+    return cached_time;
+}
+
+// Move every published record from the ring to the batches. Only one thread at a time runs it
+static size_t log_drain() {
+    char line[LOG_MESSAGE_SIZE + 256];
+    size_t drained = 0;
+
+    size_t dropped = atomic_exchange(&log_dropped, 0);
+    if (dropped > 0) {
+        LogStream *stream = &log_streams[LOG_MAX_STREAMS - 1];
+        uint64_t now = log_monotonic_ns();
+        if (stream->binary) {
+            int length = snprintf(line, sizeof(line), "%zu records dropped, the ring was full", dropped);
+            log_stream_append_trace(stream, TRACE_EVENT, 0, now, line, length, NULL, 0);
+        } else {
+            int length = snprintf(line, sizeof(line), "[%s] => [logger] %zu records dropped, the ring was full\n",
+                                  log_time_text(now), dropped);
+            log_stream_append(stream, line, length);
+        }
+    }
+
+    while (1) {
+        size_t position = atomic_load_explicit(&log_tail, memory_order_relaxed);
+        LogRecord *record = &log_ring[position & (LOG_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        if (sequence != position + 1) break;
+
+        LogStream *stream = &log_streams[record->stream];
+        if (stream->binary) {
+            // Only the raw message is copied, the call site is described once per trace
+            int site = record->site;
+            if (site < LOG_MAX_SITES && !(stream->sites[site / 8] & (1 << (site % 8)))) {
+                uint32_t source_line = record->line;
+                log_stream_append_trace(stream, TRACE_SITE, site, record->time, &source_line, sizeof(source_line),
+                                        record->source, strlen(record->source));
+                if (record->format != NULL) {
+                    log_stream_append_trace(stream, TRACE_FORMAT, site, record->time, record->format, strlen(record->format), NULL, 0);
+                }
+                stream->sites[site / 8] |= 1 << (site % 8);
+            }
+            if (record->format != NULL) {
+                log_stream_append_trace(stream, TRACE_VALUES, site, record->time, record->arguments,
+                                        sizeof(int64_t) * record->n_arguments, NULL, 0);
+            } else {
+                log_stream_append_trace(stream, TRACE_EVENT, site, record->time, record->message, strlen(record->message), NULL, 0);
+            }
+        } else {
+            // The arguments of a LOG_EVENT are formatted here, in the writer
+            if (record->format != NULL) {
+                trace_format(record->message, sizeof(record->message), record->format, record->arguments, record->n_arguments);
+            }
+            int length = snprintf(line, sizeof(line), "[%s] => Generated at line [%d] by [%s] with the following message: %s\n",
+                                  log_time_text(record->time), record->line, record->source, record->message);
+            if (length >= (int)sizeof(line)) length = sizeof(line) - 1;
+            log_stream_append(stream, line, length);
+        }
+
+        atomic_store_explicit(&record->sequence, position + LOG_RING_SIZE, memory_order_release);
+        atomic_store_explicit(&log_tail, position + 1, memory_order_relaxed);
+        drained++;
+    }
+
+    for (int i = 0; i < atomic_load(&log_n_streams); i++) {
+        log_stream_flush(&log_streams[i]);
+    }
+    return drained;
+}
+
+// Body of the background writer: empties the ring, then sleeps for a while if nothing arrived
+static void *log_writer_thread() {
+    struct timespec interval = {0, LOG_FLUSH_INTERVAL};
+    while (1) {
+        int expected = 0;
+        size_t drained = 0;
+        if (atomic_compare_exchange_strong(&log_draining, &expected, 1)) {
+            drained = log_drain();
+            atomic_store(&log_draining, 0);
+        }
+        if (drained == 0) nanosleep(&interval, NULL);
+    }
+    return NULL;
+}
+
+// Called at exit: write everything still in the ring
+static void log_flush() {
+    int expected = 0;
+    while (!atomic_compare_exchange_weak(&log_draining, &expected, 1)) {
+        expected = 0;
+        sched_yield();
+    }
+    log_drain();
+    atomic_store(&log_draining, 0);
+}
+
+// The forked child has no writer and may have copied the ring and the batches while they were
+// being emptied. What it inherited is written by the parent, so the child starts from an empty
+// ring and empty batches
+static void log_after_fork() {
+    size_t head = atomic_load(&log_head);
+    for (size_t position = atomic_load(&log_tail); position != head; position++) {
+        atomic_store(&log_ring[position & (LOG_RING_SIZE - 1)].sequence, position + LOG_RING_SIZE);
+    }
+    atomic_store(&log_tail, head);
+    atomic_store(&log_dropped, 0);
+    atomic_store(&log_draining, 0);
+    // The child has a new pid, so its trace starts again with the clock and the call sites
+    for (int i = 0; i < atomic_load(&log_n_streams); i++) {
+        log_streams[i].length = 0;
+        if (log_streams[i].binary) log_stream_start_trace(&log_streams[i]);
+    }
+}
+
+// Stream of a file registered with start_log_writer, -1 for any other file
+static int log_stream_of(FILE *file) {
+    for (int i = 0; i < atomic_load(&log_n_streams); i++) {
+        if (log_streams[i].file == file) return i;
+    }
+    return -1;
+}
+
+/**
+ * Take the next free slot of the ring and fill in the call site and the time. The caller fills
+ * the content and publishes the slot at `position + 1`. Returns NULL when the ring is full.
+ */
+static LogRecord *log_claim(int stream, int *site, int line, const char *source, size_t *position) {
+    LogRecord *record;
+    size_t head = atomic_load_explicit(&log_head, memory_order_relaxed);
+    while (1) {
+        record = &log_ring[head & (LOG_RING_SIZE - 1)];
+        size_t sequence = atomic_load_explicit(&record->sequence, memory_order_acquire);
+        if (sequence == head) {
+            if (atomic_compare_exchange_weak_explicit(&log_head, &head, head + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if (sequence < head) {
+            atomic_fetch_add(&log_dropped, 1);
+            return NULL;
+        } else {
+            head = atomic_load_explicit(&log_head, memory_order_relaxed);
+        }
+    }
+
+    int id = __atomic_load_n(site, __ATOMIC_RELAXED);
+    if (id == 0) {
+        int expected = 0;
+        id = atomic_fetch_add(&log_n_sites, 1) + 1;
+        if (!__atomic_compare_exchange_n(site, &expected, id, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) id = expected;
+    }
+
+    record->time = log_monotonic_ns();
+    record->stream = stream;
+    record->site = id;
+    record->line = line;
+    record->source = source;
+    *position = head;
+    return record;
+}
+
+/**
+ * Push a record in the ring of the process. For the files registered with start_log_writer it
+ * never blocks and never performs a system call, so it can be used from the signal handlers and
+ * from the time critical loops. Any other file, or a log written before start_log_writer runs,
+ * goes through writeLog: a synchronous write under flock, not safe in a signal handler.
+ * `site` points to a static variable of the call site, which receives its id at the first call.
+ */
+static void log_push(FILE *file, int *site, int line, const char *source, const char *message) {
+    int stream = log_stream_of(file);
+    if (stream < 0) {
+        char log[4096];
+        snprintf(log, sizeof(log), "Generated at line [%d] by [%s] with the following message: %s", line, source, message);
+        writeLog(file, log);
+        return;
+    }
+
+    size_t position;
+    LogRecord *record = log_claim(stream, site, line, source, &position);
+    if (record == NULL) return;
+    size_t length = strnlen(message, LOG_MESSAGE_SIZE - 1);
+    memcpy(record->message, message, length);
+    record->message[length] = '\0';
+    record->format = NULL;
+    atomic_store_explicit(&record->sequence, position + 1, memory_order_release);
+}
+
+/**
+ * Push a record of LOG_EVENT: only the format pointer and the integer arguments are copied,
+ * the writer formats them, or arp-tracedump in binary mode. The format has to be a literal,
+ * it is read long after the call. Same guarantees as log_push.
+ */
+static void log_push_event(FILE *file, int *site, int line, const char *source, const char *format,
+                           const int64_t *arguments, int count) {
+    int stream = log_stream_of(file);
+    if (stream < 0) {
+        char message[LOG_MESSAGE_SIZE];
+        trace_format(message, sizeof(message), format, arguments, count);
+        log_push(file, site, line, source, message);
+        return;
+    }
+
+    size_t position;
+    LogRecord *record = log_claim(stream, site, line, source, &position);
+    if (record == NULL) return;
+    if (count > LOG_MAX_ARGUMENTS) count = LOG_MAX_ARGUMENTS;
+    memcpy(record->arguments, arguments, sizeof(int64_t) * count);
+    record->n_arguments = count;
+    record->format = format;
+    atomic_store_explicit(&record->sequence, position + 1, memory_order_release);
+}
+
+/**
+ * Register the two log files of the process and start the background writer.
+ * From now on LOG_TO_FILE on these files only copies the message in the ring.
+ * When ARP_LOG_FORMAT is "binary" the records go to debug.trace and errors.trace instead.
+ */
+static void start_log_writer(FILE *debug, FILE *errors) {
+    FILE *files[LOG_MAX_STREAMS] = {debug, errors};
+    const char *traces[LOG_MAX_STREAMS] = {DEBUG_TRACE_FILE, ERRORS_TRACE_FILE};
+    const char *format = getenv(LOG_FORMAT_VARIABLE);
+    int binary = format != NULL && strcmp(format, "binary") == 0;
+
+    struct timespec wall;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    log_clock_offset = (int64_t)wall.tv_sec * 1000000000LL + wall.tv_nsec - (int64_t)log_monotonic_ns();
+
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&log_ring[i].sequence, i);
+    }
+    for (int i = 0; i < LOG_MAX_STREAMS; i++) {
+        log_streams[i].file = files[i];
+        log_streams[i].binary = binary;
+        log_streams[i].length = 0;
+        if (binary) {
+            log_streams[i].fd = open(traces[i], O_WRONLY | O_CREAT | O_APPEND, 0666);
+        } else {
+            log_streams[i].fd = dup(fileno(files[i]));
+        }
+        if (log_streams[i].fd == -1) {
+            perror("Failed to open the log file for the writer");
+            return;
+        }
+        if (binary) log_stream_start_trace(&log_streams[i]);
+    }
+
+    // Signals must never interrupt the writer while it owns the ring: the thread is created with
+    // everything blocked, so a signal sent to the process can never be delivered to it, not even
+    // before it runs for the first time
+    sigset_t all, previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &previous);
+    pthread_t writer;
+    int created = pthread_create(&writer, NULL, log_writer_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+    if (created != 0) {
+        perror("Failed to start the log writer");
+        return;
+    }
+    pthread_detach(writer);
+    pthread_atfork(NULL, NULL, log_after_fork);
+    atexit(log_flush);
+    atomic_store(&log_n_streams, LOG_MAX_STREAMS);
+}
+
+#endif
@@ -4,34 +4,50 @@
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
 #include <stdbool.h>
+#include <string.h>
 #include "cJSON/cJSON.h"
 #include "helper.h"
+#include "prng.h"
+#include "ready.h"
+#include "heartbeat.h"
 
 FILE *debug, *errors;       // File descriptors for the two log files
 
-// Gets the pid of the process running on the Konsole terminal
-int get_konsole_child(pid_t konsole) {
-    char cmd[100];
-    sprintf(cmd, "ps --ppid %d -o pid= 2>/dev/null", konsole);
-
-    FILE *pipe = popen(cmd, "r");
-    if (pipe == NULL) {
-        perror("popen");
+// Wait until the components in [first, last] report that they are ready, if they do not the started ones are shut down
+void wait_ready(int ready_fd, pid_t *ready_pids, const pid_t *started, int n_started, int first, int last, uint64_t launch) {
+    if (ready_wait(ready_fd, ready_pids, first, last, READY_TIMEOUT_MS) == -1) {
+        perror("Error waiting for the components");
+        LOG_TO_FILE(errors, "A component did not report that it is ready in time");
+        for (int i = 0; i < n_started; i++) kill(started[i], SIGUSR2);
         // Close the files
         fclose(debug);
         fclose(errors);
         exit(EXIT_FAILURE);
     }
+    char message[100];
+    snprintf(message, sizeof(message), "Components %d to %d ready %.1f ms after the launch", first, last, (monotonic_ns() - launch) / 1e6);
+    LOG_TO_FILE(debug, message);
+}
 
-    int pid;
-    fscanf(pipe, "%d", &pid);
-
-    pclose(pipe);
-    return pid;
+// Log how a child ended and the resources it used
+void log_exit(const char *name, pid_t pid, int status, const struct rusage *usage) {
+    char outcome[64], message[256];
+    if (WIFEXITED(status)) {
+        snprintf(outcome, sizeof(outcome), "exited with status %d", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        snprintf(outcome, sizeof(outcome), "was killed by signal %d (%s)", WTERMSIG(status), strsignal(WTERMSIG(status)));
+    } else {
+        snprintf(outcome, sizeof(outcome), "ended with status %d", status);
+    }
+    snprintf(message, sizeof(message), "The %s [%d] %s, user %ld.%03ld s, system %ld.%03ld s, max RSS %ld kB", name, pid, outcome,
+             (long)usage->ru_utime.tv_sec, (long)usage->ru_utime.tv_usec / 1000,
+             (long)usage->ru_stime.tv_sec, (long)usage->ru_stime.tv_usec / 1000, usage->ru_maxrss);
+    LOG_TO_FILE(WIFEXITED(status) && WEXITSTATUS(status) == 0 ? debug : errors, message);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     /* OPEN THE LOG FILES */
     debug = fopen("debug.log", "a");
     if (debug == NULL) {
@@ -43,66 +59,91 @@ int main() {
         perror("Error opening the errors file");
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
+
+    /* READ THE RUN MODE */
+    // The options are handed to the keyboard manager. Without the keyboard (--headless <script> or --replay <journal> [speed])
+    // every component runs without konsole and ncurses, --record <journal> saves the keys sent
+    bool headless = false, missing = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], HEADLESS_FLAG) == 0 || strcmp(argv[i], REPLAY_FLAG) == 0) headless = true;
+        if ((strcmp(argv[i], HEADLESS_FLAG) == 0 || strcmp(argv[i], REPLAY_FLAG) == 0 || strcmp(argv[i], RECORD_FLAG) == 0 ||
+             strcmp(argv[i], SEED_FLAG) == 0) && i == argc - 1) missing = true;
+    }
+    if (missing) {
+        printf("Usage: %s [%s <key script or fifo> | %s <journal> [speed, 0 for maximum]] [%s <journal>] [%s <world seed>]\n",
+               argv[0], HEADLESS_FLAG, REPLAY_FLAG, RECORD_FLAG, SEED_FLAG);
+        LOG_TO_FILE(errors, "Missing the file of an option");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
 
     /*  INTRODUCTION */
-    char key;
-    bool forward = false;
-    printf("\n\n\t\t   In this thrilling drone control challenge, you’ll need to navigate\n");
-    printf("\t\t   through an obstacle-filled environment. Your skills will be tested,\n");
-    printf("\t\t   and only the best will be able to complete the mission.\n");
-    printf("\t\t   Use the controls wisely and stay sharp!\n\n");
+    if (!headless) {
+        char key;
+        bool forward = false;
+        printf("\n\n\t\t   In this thrilling drone control challenge, you’ll need to navigate\n");
+        printf("\t\t   through an obstacle-filled environment. Your skills will be tested,\n");
+        printf("\t\t   and only the best will be able to complete the mission.\n");
+        printf("\t\t   Use the controls wisely and stay sharp!\n\n");
 
-    printf("\t\t  ###########################\n");
-    printf("\t\t  #  COMMANDS AND CONTROLS  #\n");
-    printf("\t\t  ###########################\n");
-    printf("\n");
-    printf("\t\t  Move Up                : E\n");
-    printf("\t\t  Move Down              : C\n");
-    printf("\t\t  Move Left              : S\n");
-    printf("\t\t  Move Right             : F\n");
-    printf("\t\t  Move Up-Right          : R\n");
-    printf("\t\t  Move Up-Left           : W\n");
-    printf("\t\t  Move Down-Right        : V\n");
-    printf("\t\t  Move Down-Left         : X\n");
-    printf("\n");
-    printf("\t\t  Remove All Forces      : D\n");
-    printf("\t\t  Brake                  : B\n");
-    printf("\t\t  Reset the Drone        : U\n");
-    printf("\t\t  Quit the Game          : P\n");
-    printf("\n");
-    printf("\t\t  ###########################\n");
+        printf("\t\t  ###########################\n");
+        printf("\t\t  #  COMMANDS AND CONTROLS  #\n");
+        printf("\t\t  ###########################\n");
+        printf("\n");
+        printf("\t\t  Move Up                : E\n");
+        printf("\t\t  Move Down              : C\n");
+        printf("\t\t  Move Left              : S\n");
+        printf("\t\t  Move Right             : F\n");
+        printf("\t\t  Move Up-Right          : R\n");
+        printf("\t\t  Move Up-Left           : W\n");
+        printf("\t\t  Move Down-Right        : V\n");
+        printf("\t\t  Move Down-Left         : X\n");
+        printf("\n");
+        printf("\t\t  Remove All Forces      : D\n");
+        printf("\t\t  Brake                  : B\n");
+        printf("\t\t  Reset the Drone        : U\n");
+        printf("\t\t  Next Drone (then all)  : N\n");
+        printf("\t\t  Quit the Game          : P\n");
+        printf("\n");
+        printf("\t\t  ###########################\n");
 
-    printf("\nEnter 's' to start the game or 'p' to quit\n");
-    scanf("%c", &key);
-    do {
-        switch (key) {
-            case 's':
-                forward = true;
-                printf("\n\n\t\t    ****************************************\n");
-                printf("\t\t    *          GAME STARTED!            *\n");
-                printf("\t\t    *    Get ready to control the drone!   *\n");
-                printf("\t\t    ****************************************\n\n");
-                break;
-            case 'p':
-                printf("\n\t\t    ****************************************\n");
-                printf("\t\t    *     You have quit the game. Goodbye!  *\n");
-                printf("\t\t    ****************************************\n");
-                exit(EXIT_SUCCESS);
-            default:
-                printf("\nInvalid input. Enter 's' to start or 'p' to quit\n");
-                scanf("%c", &key);
-                break;
-        }
-    } while (!forward);
+        printf("\nEnter 's' to start the game or 'p' to quit\n");
+        scanf("%c", &key);
+        do {
+            switch (key) {
+                case 's':
+                    forward = true;
+                    printf("\n\n\t\t    ****************************************\n");
+                    printf("\t\t    *          GAME STARTED!            *\n");
+                    printf("\t\t    *    Get ready to control the drone!   *\n");
+                    printf("\t\t    ****************************************\n\n");
+                    break;
+                case 'p':
+                    printf("\n\t\t    ****************************************\n");
+                    printf("\t\t    *     You have quit the game. Goodbye!  *\n");
+                    printf("\t\t    ****************************************\n");
+                    exit(EXIT_SUCCESS);
+                default:
+                    printf("\nInvalid input. Enter 's' to start or 'p' to quit\n");
+                    scanf("%c", &key);
+                    break;
+            }
+        } while (!forward);
+    }
 
     /* IMPORT CONFIGURATION FROM JSON FILE */
-    char jsonBuffer[1024];
+    char jsonBuffer[4096];
     FILE *file = fopen("appsettings.json", "r");
     if (file == NULL) {
         perror("Error opening the file");
         return EXIT_FAILURE;//1
     }
-    int len = fread(jsonBuffer, 1, sizeof(jsonBuffer), file); 
+    int len = fread(jsonBuffer, 1, sizeof(jsonBuffer) - 1, file); 
+    jsonBuffer[len] = '\0';
     fclose(file);
 
     cJSON *json = cJSON_Parse(jsonBuffer);
@@ -115,6 +156,75 @@ int main() {
     snprintf(n_obs, sizeof(n_obs), "%d", cJSON_GetObjectItemCaseSensitive(json, "NumObstacles")->valueint);
     snprintf(n_target, sizeof(n_target), "%d", cJSON_GetObjectItemCaseSensitive(json, "NumTargets")->valueint);
 
+    // Number of drones of the swarm, read by the server that creates their shared memory
+    if (cJSON_IsNumber(cJSON_GetObjectItemCaseSensitive(json, "NumDrones"))) {
+        char n_drones[10];
+        snprintf(n_drones, sizeof(n_drones), "%d", cJSON_GetObjectItemCaseSensitive(json, "NumDrones")->valueint);
+        setenv(DRONES_VARIABLE, n_drones, 1);
+    }
+
+    // Configuration of the physics, the defaults keep the original behaviour
+    double physics_rate = PHYSICS_RATE, time_scale = TIME_SCALE;
+    int max_catch_up = MAX_CATCH_UP;
+    cJSON *physics = cJSON_GetObjectItemCaseSensitive(json, "Physics");
+    if (cJSON_IsNumber(cJSON_GetObjectItem(physics, "Rate"))) physics_rate = cJSON_GetObjectItem(physics, "Rate")->valuedouble;
+    if (cJSON_IsNumber(cJSON_GetObjectItem(physics, "TimeScale"))) time_scale = cJSON_GetObjectItem(physics, "TimeScale")->valuedouble;
+    if (cJSON_IsNumber(cJSON_GetObjectItem(physics, "MaxCatchUp"))) max_catch_up = cJSON_GetObjectItem(physics, "MaxCatchUp")->valueint;
+    char physics_rate_str[20], time_scale_str[20], max_catch_up_str[10];
+    snprintf(physics_rate_str, sizeof(physics_rate_str), "%f", physics_rate);
+    snprintf(time_scale_str, sizeof(time_scale_str), "%f", time_scale);
+    snprintf(max_catch_up_str, sizeof(max_catch_up_str), "%d", max_catch_up);
+
+    // Maximum FPS of the map and the info window, handed to every process through the environment
+    cJSON *display = cJSON_GetObjectItemCaseSensitive(json, "Display");
+    if (cJSON_IsNumber(cJSON_GetObjectItem(display, "MaxFps"))) {
+        char max_fps_str[20];
+        snprintf(max_fps_str, sizeof(max_fps_str), "%f", cJSON_GetObjectItem(display, "MaxFps")->valuedouble);
+        setenv(MAX_FPS_VARIABLE, max_fps_str, 1);
+    }
+
+    // Periods and jitter (s) of the generations of obstacles and targets, read by the server
+    cJSON *generation = cJSON_GetObjectItemCaseSensitive(json, "Generation");
+    const char *generation_keys[] = {"ObstaclesPeriod", "TargetsPeriod", "Jitter"};
+    const char *generation_variables[] = {OBSTACLES_PERIOD_VARIABLE, TARGETS_PERIOD_VARIABLE, GENERATION_JITTER_VARIABLE};
+    for (int i = 0; i < 3; i++) {
+        if (cJSON_IsNumber(cJSON_GetObjectItem(generation, generation_keys[i]))) {
+            char seconds_str[20];
+            snprintf(seconds_str, sizeof(seconds_str), "%f", cJSON_GetObjectItem(generation, generation_keys[i])->valuedouble);
+            setenv(generation_variables[i], seconds_str, 1);
+        }
+    }
+
+    // Transport of the sets, "shared" (the world shared memory) or "stream" (chunks through the pipes), read by the generators
+    cJSON *transport = cJSON_GetObjectItem(generation, "Transport");
+    if (cJSON_IsString(transport)) setenv(WORLD_TRANSPORT_VARIABLE, transport->valuestring, 1);
+
+    // Seed of the world: command line, then appsettings.json, otherwise a new one that is logged to replay the session
+    uint64_t seed = 0;
+    bool seeded = false;
+    cJSON *seed_item = cJSON_GetObjectItemCaseSensitive(json, "Seed");
+    if (cJSON_IsNumber(seed_item)) {
+        seed = (uint64_t)seed_item->valuedouble;
+        seeded = true;
+    } else if (cJSON_IsString(seed_item)) {
+        seed = strtoull(seed_item->valuestring, NULL, 10);
+        seeded = true;
+    }
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], SEED_FLAG) == 0) {
+            seed = strtoull(argv[i + 1], NULL, 10);
+            seeded = true;
+        }
+    }
+    if (!seeded) {
+        uint64_t state = monotonic_ns() ^ ((uint64_t)getpid() << 32) ^ (uint64_t)time(NULL);
+        seed = splitmix64(&state);
+    }
+    char seed_str[24], seed_message[64];
+    snprintf(seed_str, sizeof(seed_str), "%llu", (unsigned long long)seed);
+    snprintf(seed_message, sizeof(seed_message), "World seed %s", seed_str);
+    LOG_TO_FILE(debug, seed_message);
+
     cJSON *initial_position = cJSON_GetObjectItemCaseSensitive(json,"DroneInitialPosition");
     cJSON *position = cJSON_GetObjectItem(initial_position, "Position");
     cJSON *velocity = cJSON_GetObjectItem(initial_position, "Velocity");
@@ -135,7 +245,7 @@ int main() {
     snprintf(vel_str, sizeof(vel_str), "%f,%f", vel[0], vel[1]);
     snprintf(force_str, sizeof(force_str), "%f,%f", f[0], f[1]);
 
-    int drone_map_fds[2], drone_key_fds[2], input_pipe_fds[2], obstacle_position_fds[2], target_position_fds[2], obstacle_map_fds[2], target_map_fds[2], server_obstacles_fds[2], server_targets_fds[2];
+    int drone_map_fds[2], drone_key_fds[2], input_pipe_fds[2], obstacle_position_fds[2], target_position_fds[2], obstacle_map_fds[2], target_map_fds[2], server_obstacles_fds[2], server_targets_fds[2], drone_events_fds[2];
     if (pipe(drone_map_fds) == -1) {
         perror("Error creating the pipe for the drone");
         LOG_TO_FILE(errors, "Error creating the pipe for the drone-map");
@@ -208,6 +318,14 @@ int main() {
         fclose(errors);
         exit(EXIT_FAILURE);
     }
+    if (pipe(drone_events_fds) == -1) {
+        perror("Error creating the pipe for the drone");
+        LOG_TO_FILE(errors, "Error creating the pipe for the drone-events");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
 
     /* CONVERT INTO STRING ALL THE FILE DESCRIPTOR */
     char drone_write_map_fd_str[10], drone_write_key_fd_str[10], input_write_fd_str[10];
@@ -218,6 +336,7 @@ int main() {
     char target_write_map_fd_str[10], target_read_map_fd_str[10];
     char server_write_obstacles_fd_str[10], server_read_obstacles_fd_str[10];
     char server_write_targets_fd_str[10], server_read_targets_fd_str[10];
+    char drone_write_events_fd_str[10], server_read_events_fd_str[10];
 
     snprintf(obstacle_write_map_fd_str, sizeof(obstacle_write_map_fd_str), "%d", obstacle_map_fds[1]);
     snprintf(target_write_map_fd_str, sizeof(target_write_map_fd_str), "%d", target_map_fds[1]);
@@ -237,14 +356,40 @@ int main() {
     snprintf(server_read_obstacles_fd_str, sizeof(server_read_obstacles_fd_str), "%d", server_obstacles_fds[0]);
     snprintf(server_write_targets_fd_str, sizeof(server_write_targets_fd_str), "%d", server_targets_fds[1]);
     snprintf(server_read_targets_fd_str, sizeof(server_read_targets_fd_str), "%d", server_targets_fds[0]);
+    snprintf(drone_write_events_fd_str, sizeof(drone_write_events_fd_str), "%d", drone_events_fds[1]);
+    snprintf(server_read_events_fd_str, sizeof(server_read_events_fd_str), "%d", drone_events_fds[0]);
+
+    /* CREATE THE HEARTBEAT */
+    // Every process beats in its own slot, the watchdog only reads them
+    if (heartbeat_create() == NULL) {
+        perror("Error creating the heartbeat shared memory");
+        LOG_TO_FILE(errors, "Error creating the heartbeat shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
+
+    /* OPEN THE CONTROL CHANNEL */
+    // Every component reports here when it is ready, the next ones are launched right after
+    int ready_fd = ready_listen();
+    if (ready_fd == -1) {
+        perror("Error creating the readiness socket");
+        LOG_TO_FILE(errors, "Error creating the readiness socket");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
+    uint64_t launch = monotonic_ns();
 
     /* LAUNCH THE SERVER AND THE DRONE */
-    pid_t pids[N_PROCS], wd;
-    char *inputs[N_PROCS - 1][16] = {
-        {"./server", drone_write_map_fd_str, drone_write_key_fd_str, input_read_fd_str, obstacle_write_map_fd_str, obstacle_read_position_fd_str, target_write_map_fd_str, target_read_position_fd_str, server_write_obstacles_fd_str, server_write_targets_fd_str, pos_str, vel_str, force_str, n_obs, n_target, NULL}, 
-        {"./drone", drone_read_map_fd_str, drone_read_key_fd_str, server_read_obstacles_fd_str, server_read_targets_fd_str, NULL},
-        {"./obstacle", obstacle_write_position_fd_str, obstacle_read_map_fd_str, n_obs, NULL},
-        {"./target", target_write_position_fd_str, target_read_map_fd_str, n_target, n_target, NULL}
+    pid_t pids[N_PROCS], ready_pids[N_PROCS], wd;
+    char *inputs[N_PROCS - 1][18] = {
+        {"./server", drone_write_map_fd_str, drone_write_key_fd_str, input_read_fd_str, obstacle_write_map_fd_str, obstacle_read_position_fd_str, target_write_map_fd_str, target_read_position_fd_str, server_write_obstacles_fd_str, server_write_targets_fd_str, pos_str, vel_str, force_str, n_obs, n_target, server_read_events_fd_str, headless ? HEADLESS_FLAG : NULL, NULL}, 
+        {"./drone", drone_read_map_fd_str, drone_read_key_fd_str, server_read_obstacles_fd_str, server_read_targets_fd_str, physics_rate_str, time_scale_str, max_catch_up_str, drone_write_events_fd_str, NULL},
+        {"./obstacle", obstacle_write_position_fd_str, obstacle_read_map_fd_str, n_obs, seed_str, NULL},
+        {"./target", target_write_position_fd_str, target_read_map_fd_str, n_target, seed_str, NULL}
     };
     for (int i = 0; i < N_PROCS - 1; i++) {
         pids[i] = fork();
@@ -264,12 +409,24 @@ int main() {
             fclose(errors);
             exit(EXIT_FAILURE);
         }
-        usleep(500000);
+        // The others open the shared memory created by the server, then they start together
+        if (i == PROC_SERVER) wait_ready(ready_fd, ready_pids, pids, i + 1, PROC_SERVER, PROC_SERVER, launch);
     }
+    wait_ready(ready_fd, ready_pids, pids, N_PROCS - 1, PROC_DRONE, PROC_TARGET, launch);
 
     /* LAUNCH THE INPUT */
+    // In headless mode the keyboard manager is started directly and reads the keys from the script or the journal
     pid_t konsole = fork();
-    char *keyboard_input[] = {"konsole", "-e", "./keyboard_manager", input_write_fd_str, NULL};
+    char *keyboard_input[argc + 4];
+    keyboard_input[0] = "konsole";
+    keyboard_input[1] = "-e";
+    keyboard_input[2] = "./keyboard_manager";
+    keyboard_input[3] = input_write_fd_str;
+    for (int i = 1; i < argc; i++) {
+        keyboard_input[i + 3] = argv[i];
+    }
+    keyboard_input[argc + 3] = NULL;
+    char **keyboard_command = headless ? keyboard_input + 2 : keyboard_input;
     if (konsole < 0) {
         perror("Error forking the keyboard manager");
         LOG_TO_FILE(errors, "Error forking the keyboard manager");
@@ -278,26 +435,25 @@ int main() {
         fclose(errors);
         exit(EXIT_FAILURE);
     } else if (konsole == 0) {
-        execvp(keyboard_input[0], keyboard_input);
+        execvp(keyboard_command[0], keyboard_command);
         perror("Failed to execute to launch the keyboard manager");
         LOG_TO_FILE(errors, "Failed to execute to launch the keyboard manager");
         // Close the files
         fclose(debug);
         fclose(errors);
         exit(EXIT_FAILURE);
-    } else {
-        usleep(500000);    
-        pids[N_PROCS - 1] = get_konsole_child(konsole);
     }
-    
-    usleep(500000);
+    // Under konsole the pid of the keyboard manager is known only from its report
+    pids[N_PROCS - 1] = konsole;
+    wait_ready(ready_fd, ready_pids, pids, N_PROCS, PROC_INPUT, PROC_INPUT, launch);
+    close(ready_fd);
 
     /* LAUNCH THE WATCHDOG */
     char pids_string[N_PROCS][50];
     char *wd_input[N_PROCS + 2];
     wd_input[0] = "./watchdog";
     for(int i = 0; i < N_PROCS; i++) {
-        sprintf(pids_string[i], "%d", pids[i]);
+        sprintf(pids_string[i], "%d", ready_pids[i]);
         wd_input[i + 1] = pids_string[i];
     }
     wd_input[N_PROCS + 1] = NULL;
@@ -319,13 +475,24 @@ int main() {
         exit(EXIT_FAILURE);
     }
 
-    for(int i = 0; i < N_PROCS; i++) {
-        wait(NULL);
+    // The watchdog supervises the processes, the main reaps them and reports their exit status and resources
+    const char *names[N_PROCS] = {"server", "drone", "obstacle", "target", headless ? "keyboard manager" : "konsole of the keyboard manager"};
+    for (int i = 0; i < N_PROCS + 1; i++) {
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, 0, &usage);
+        if (pid == -1) break;
+        const char *name = pid == wd ? "watchdog" : "process";
+        for (int j = 0; j < N_PROCS; j++) {
+            if (pid == pids[j]) name = names[j];
+        }
+        log_exit(name, pid, status, &usage);
     }
-    wait(NULL);
 
     /* END PROGRAM */
 
+    shm_unlink(HEARTBEAT_SHARED_MEMORY);
+
     // Close the files
     fclose(debug);
     fclose(errors);
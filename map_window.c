@@ -6,78 +6,170 @@
 #include <unistd.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/select.h>
 #include <errno.h>
+#include <pthread.h>
 #include "helper.h"
+#include "frame.h"
+#include "world.h"
 
 FILE *debug, *errors;           // File descriptors for the two log files
 Game game;
-Drone *drone;
+Swarm *swarm;
+Drone *drones;                  // Last snapshot of the swarm
+int *drone_cells;               // Cell of each drone in the last frame, -1 before the first one
 int server_write_fd;            // File descriptor for sending the size of the map to the server
-Object obstacles, targets;
+World *world;
+WorldSnapshot obstacles, targets;   // Sets drawn on the map, copied when their version changes
 int n_obs;
 int n_targ;
+int headless;                   // Consume the state without drawing it
+
+// Cells of the map: the last frame sent to the terminal and the one being composed
+typedef struct {
+    int rows, cols;
+    chtype *cells;                  // Last frame sent, 0 where the terminal content is unknown
+    chtype *next;
+} MapFrame;
+
+MapFrame map_frame;
+volatile sig_atomic_t map_resized = 1;  // The next frame is sent whole
+atomic_int resize_pending;              // Set on SIGWINCH, the render thread resizes the terminal
+
+// Sets streamed through the pipe, assembled by the main thread and handed to the render thread
+typedef struct {
+    pthread_mutex_t lock;
+    WorldSnapshot sets[WORLD_SETS];
+    int ready[WORLD_SETS];          // A complete set is waiting to be drawn
+} StreamedSets;
+
+StreamedSets streamed = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// Copy a complete set received from the server, returns -1 when the copy cannot grow
+int store_streamed(int set, const FrameBuffer *frame) {
+    uint32_t count = frame->header.count;
+    pthread_mutex_lock(&streamed.lock);
+    WorldSnapshot *snapshot = &streamed.sets[set];
+    if (count > snapshot->capacity) {
+        int32_t *x = realloc(snapshot->x, sizeof(int32_t) * count);
+        if (x != NULL) snapshot->x = x;
+        int32_t *y = realloc(snapshot->y, sizeof(int32_t) * count);
+        if (y != NULL) snapshot->y = y;
+        int32_t *point = realloc(snapshot->point, sizeof(int32_t) * count);
+        if (point != NULL) snapshot->point = point;
+        if (x == NULL || y == NULL || point == NULL) {
+            pthread_mutex_unlock(&streamed.lock);
+            return -1;
+        }
+        snapshot->capacity = count;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        snapshot->x[i] = frame->objects[i].pos_x;
+        snapshot->y[i] = frame->objects[i].pos_y;
+        snapshot->point[i] = frame->objects[i].point;
+    }
+    snapshot->generation = frame->header.generation;
+    snapshot->count = count;
+    streamed.ready[set] = 1;
+    pthread_mutex_unlock(&streamed.lock);
+    return 0;
+}
+
+/**
+ * Take the streamed set waiting to be drawn, if any: the arrays are swapped, not copied.
+ * The snapshot keeps the version of the set in the world shared memory, so it is not
+ * replaced by that one until the generator publishes there again. Returns 1 if taken.
+ */
+int take_streamed(int set, WorldSnapshot *snapshot) {
+    int taken = 0;
+    pthread_mutex_lock(&streamed.lock);
+    if (streamed.ready[set]) {
+        WorldSnapshot previous = *snapshot;
+        *snapshot = streamed.sets[set];
+        streamed.sets[set] = previous;
+        streamed.ready[set] = 0;
+        snapshot->version = world_version(world, set);
+        taken = 1;
+    }
+    pthread_mutex_unlock(&streamed.lock);
+    return taken;
+}
+
+// Put a cell in the frame being composed, cells outside the window are dropped
+void frame_put(int y, int x, chtype ch) {
+    if (y >= 0 && y < map_frame.rows && x >= 0 && x < map_frame.cols) {
+        map_frame.next[y * map_frame.cols + x] = ch;
+    }
+}
 
 void draw_outer_box() {
-    attron(COLOR_PAIR(1));
-    box(stdscr, 0, 0);
-    mvprintw(0, 1, "Dimension of the window: %d x %d", game.max_x, game.max_y);
-    attroff(COLOR_PAIR(1));
-    refresh();
+    int rows = map_frame.rows, cols = map_frame.cols;
+    chtype color = COLOR_PAIR(1);
+    for (int x = 1; x < cols - 1; x++) {
+        frame_put(0, x, ACS_HLINE | color);
+        frame_put(rows - 1, x, ACS_HLINE | color);
+    }
+    for (int y = 1; y < rows - 1; y++) {
+        frame_put(y, 0, ACS_VLINE | color);
+        frame_put(y, cols - 1, ACS_VLINE | color);
+    }
+    frame_put(0, 0, ACS_ULCORNER | color);
+    frame_put(0, cols - 1, ACS_URCORNER | color);
+    frame_put(rows - 1, 0, ACS_LLCORNER | color);
+    frame_put(rows - 1, cols - 1, ACS_LRCORNER | color);
+
+    char title[64];
+    int length = snprintf(title, sizeof(title), "Dimension of the window: %d x %d", game.max_x, game.max_y);
+    for (int i = 0; i < length; i++) {
+        frame_put(0, 1 + i, (unsigned char)title[i] | color);
+    }
 }
 
-void render_obstacles(Object obstacles[]) {
-    attron(COLOR_PAIR(3));
-    for(int i = 0; i < n_obs; i++){
-        mvprintw(obstacles[i].pos_y, obstacles[i].pos_x, "#");
+void render_obstacles(WorldSnapshot *obstacles) {
+    for(uint32_t i = 0; i < obstacles->count; i++){
+        frame_put(obstacles->y[i], obstacles->x[i], '#' | COLOR_PAIR(3));
     }
-    attroff(COLOR_PAIR(3));
-    refresh();
 }
 
-void render_targets(Object targets[]) {
-    attron(COLOR_PAIR(3));
-    for(int i = 0; i < n_targ; i++){
-        mvprintw(targets[i].pos_y, targets[i].pos_x, "#");
+// Targets have their own glyph and color, so they are not mistaken for obstacles
+void render_targets(WorldSnapshot *targets) {
+    for(uint32_t i = 0; i < targets->count; i++){
+        frame_put(targets->y[i], targets->x[i], 'T' | COLOR_PAIR(2));
     }
-    attroff(COLOR_PAIR(3));
-    refresh();
 }
 
-void render_drone(float x, float y) {
-    attron(COLOR_PAIR(4));
-    mvprintw(y, x, "+");
-    attroff(COLOR_PAIR(4));
-    refresh();
+void render_drones(const Drone *drones, int count) {
+    for (int i = 0; i < count; i++) {
+        frame_put((int)drones[i].pos_y, (int)drones[i].pos_x, '+' | COLOR_PAIR(4));
+    }
 }
 
 void write_to_server() {
     char buffer[50];
-    snprintf(buffer, sizeof(buffer), "%d, %d", game.max_x, game.max_y);
+    snprintf(buffer, sizeof(buffer), "%d, %d\n", game.max_x, game.max_y);
     write(server_write_fd, buffer, strlen(buffer));
 }
 
-// Resize the input window
+// Resize the map window, the map is redrawn whole at the next frame. Only the render thread uses ncurses
 void resize_window() {
     endwin();
     refresh();
-    clear();
 
     getmaxyx(stdscr, game.max_y, game.max_x);
     resize_term(game.max_y, game.max_x);
 
     write_to_server();
 
-    clear();
-    refresh();
-
-    draw_outer_box();
+    map_resized = 1;
 }
 
 // Handler for the signal SIGWINCH
 void resize_handler(int sig, siginfo_t *info, void *context) {
+    // The handler may interrupt any thread: it only asks the render thread to resize, and wakes it
     if (sig == SIGWINCH) {
-        resize_window();
+        atomic_store(&resize_pending, 1);
+        if (swarm != NULL) swarm_wake(swarm);
     }
     
     if (sig == SIGUSR2){
@@ -91,7 +183,7 @@ void resize_handler(int sig, siginfo_t *info, void *context) {
 }
 
 int open_shared_memory() {
-    int mem_fd = shm_open(DRONE_SHARED_MEMORY, O_RDONLY, 0666);
+    int mem_fd = shm_open(DRONE_SHARED_MEMORY, O_RDWR, 0666);
     if (mem_fd == -1) {
         perror("Error opening the shared memory");
         LOG_TO_FILE(errors, "Error opening the shared memory");
@@ -100,8 +192,10 @@ int open_shared_memory() {
         fclose(errors);   
         exit(EXIT_FAILURE);
     }
-    drone = (Drone *)mmap(0, sizeof(Drone), PROT_READ, MAP_SHARED, mem_fd, 0);
-    if (drone == MAP_FAILED) {
+    // Writable only to register as a waiter of the state, the segment is sized by the server for its number of drones
+    struct stat info;
+    swarm = fstat(mem_fd, &info) == -1 ? MAP_FAILED : (Swarm *)mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (swarm == MAP_FAILED) {
         perror("Error mapping the shared memory");
         LOG_TO_FILE(errors, "Error mapping the shared memory");
         // Close the files
@@ -109,55 +203,159 @@ int open_shared_memory() {
         fclose(errors);   
         exit(EXIT_FAILURE);
     }
+    drones = malloc(sizeof(Drone) * swarm->count);
+    drone_cells = malloc(sizeof(int) * swarm->count);
+    if (drones == NULL || drone_cells == NULL) {
+        perror("Error allocating the snapshot of the swarm");
+        LOG_TO_FILE(errors, "Error allocating the snapshot of the swarm");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < swarm->count; i++) drone_cells[i] = -1;
     return mem_fd;
 }
 
-void map_render(Drone *drone) {
-    char buffer[256];
-    fd_set read_fds;
-    struct timeval timeout;
-    while(1){
-        clear();
-        draw_outer_box();
-        render_drone(drone->pos_x, drone->pos_y);
-        usleep(50000);
+int open_world_memory() {
+    int world_fd = shm_open(WORLD_SHARED_MEMORY, O_RDONLY, 0666);
+    struct stat info;
+    if (world_fd == -1 || fstat(world_fd, &info) == -1) {
+        perror("Error opening the world shared memory");
+        LOG_TO_FILE(errors, "Error opening the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
     }
-
-    /*int max_fd = -1;
-    if (... > max_fd) {
-        max_fd = ...;
+    world = (World *)mmap(0, info.st_size, PROT_READ, MAP_SHARED, world_fd, 0);
+    if (world == MAP_FAILED || world->magic != WORLD_MAGIC) {
+        perror("Error mapping the world shared memory");
+        LOG_TO_FILE(errors, "Error mapping the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
     }
+    return world_fd;
+}
 
-    while(1) {
-        FD_ZERO(&read_fds);
-        FD_SET(..., &read_fds);
+// Headless counterpart of map_render: read the swarm and the world at the same rate without drawing
+void map_consume(Swarm *swarm) {
+    swarm_read(swarm, drones);
+    if (world_version(world, WORLD_OBSTACLES) != obstacles.version) {
+        world_read(world, WORLD_OBSTACLES, &obstacles);
+        LOG_EVENT(debug, "Consumed generation %u with %u obstacles", obstacles.generation, obstacles.count);
+    }
+    if (world_version(world, WORLD_TARGETS) != targets.version) {
+        world_read(world, WORLD_TARGETS, &targets);
+        LOG_EVENT(debug, "Consumed generation %u with %u targets", targets.generation, targets.count);
+    }
+    if (take_streamed(WORLD_OBSTACLES, &obstacles)) {
+        LOG_EVENT(debug, "Consumed streamed generation %u with %u obstacles", obstacles.generation, obstacles.count);
+    }
+    if (take_streamed(WORLD_TARGETS, &targets)) {
+        LOG_EVENT(debug, "Consumed streamed generation %u with %u targets", targets.generation, targets.count);
+    }
+}
 
-        timeout.tv_sec = 0;
-        timeout.tv_usec = 50000;
-        int activity;
-        do {
-            activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
-        } while(activity == -1 && errno == EINTR);
+/**
+ * Draw one frame of the map. Nothing is composed while every drone stays in the same cell and the
+ * world does not change; otherwise the frame is composed off screen and only the cells that
+ * differ from the previous frame are sent, with a single update of the terminal.
+ */
+void map_render(Swarm *swarm) {
+    int damaged = 0;
+
+    if (atomic_exchange(&resize_pending, 0)) resize_window();
+
+    if (map_resized) {
+        map_resized = 0;
+        int rows, cols;
+        getmaxyx(stdscr, rows, cols);
+        chtype *cells = realloc(map_frame.cells, sizeof(chtype) * rows * cols);
+        if (cells != NULL) map_frame.cells = cells;
+        chtype *next = realloc(map_frame.next, sizeof(chtype) * rows * cols);
+        if (next != NULL) map_frame.next = next;
+        if (cells == NULL || next == NULL) {
+            LOG_TO_FILE(errors, "Error allocating the frame of the map");
+            map_frame.rows = map_frame.cols = 0;
+            return;
+        }
+        map_frame.rows = rows;
+        map_frame.cols = cols;
+        // The terminal content is unknown: every cell differs from the next frame
+        memset(map_frame.cells, 0, sizeof(chtype) * rows * cols);
+        clear();
+        damaged = 1;
+    }
 
-        if (activity < 0) {
-            perror("Error in the map's select");
-            LOG_TO_FILE(errors, "Error in select which pipe reads");
-            break;
-        } else if (activity > 0) {
-            // Check if the map process has sent him the map size
-            if (FD_ISSET(..., &read_fds)) {
-                ssize_t bytes_read = read(..., buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0'; // End the string
-                    sscanf(buffer, "%d, %d", &game.max_x, &game.max_y);
-                }
+    swarm_read(swarm, drones);
+    for (int i = 0; i < swarm->count; i++) {
+        int cell = (int)drones[i].pos_y * game.max_x + (int)drones[i].pos_x;
+        if (cell != drone_cells[i]) {
+            drone_cells[i] = cell;
+            damaged = 1;
+        }
+    }
+    // A new set is copied only when the generator has published one
+    if (world_version(world, WORLD_OBSTACLES) != obstacles.version) {
+        world_read(world, WORLD_OBSTACLES, &obstacles);
+        damaged = 1;
+    }
+    if (world_version(world, WORLD_TARGETS) != targets.version) {
+        world_read(world, WORLD_TARGETS, &targets);
+        damaged = 1;
+    }
+    // Or when a set streamed through the pipe is complete
+    if (take_streamed(WORLD_OBSTACLES, &obstacles)) damaged = 1;
+    if (take_streamed(WORLD_TARGETS, &targets)) damaged = 1;
+    if (!damaged) return;
+
+    // Compose the frame
+    for (int i = 0; i < map_frame.rows * map_frame.cols; i++) {
+        map_frame.next[i] = ' ';
+    }
+    draw_outer_box();
+    render_obstacles(&obstacles);
+    render_targets(&targets);
+    render_drones(drones, swarm->count);
+
+    // Send only the cells that changed
+    for (int y = 0; y < map_frame.rows; y++) {
+        for (int x = 0; x < map_frame.cols; x++) {
+            int i = y * map_frame.cols + x;
+            if (map_frame.next[i] != map_frame.cells[i]) {
+                mvaddch(y, x, map_frame.next[i]);
+                map_frame.cells[i] = map_frame.next[i];
             }
+        }
+    }
+    wnoutrefresh(stdscr);
+    doupdate();
+}
+
+/**
+ * Draw a frame every time the drone process publishes the swarm, at most at the maximum FPS.
+ * While the swarm is still the thread sleeps, waking every IDLE_REDRAW_INTERVAL for new sets
+ * of the world and resizes.
+ */
+void *map_render_thread() {
+    uint64_t interval = frame_interval_ns(), last_frame = 0;
+    unsigned int version = 1;               // Odd, so it never matches a published version
+    while (1) {
+        version = swarm_wait(swarm, version, IDLE_REDRAW_INTERVAL);
+        if (monotonic_ns() < last_frame + interval) {
+            sleep_until_ns(last_frame + interval);
+            version = swarm_version(swarm);
+        }
+        last_frame = monotonic_ns();
+        if (headless) {
+            map_consume(swarm);
         } else {
-            clear();
-            draw_outer_box();
-            render_drone(drone->pos_x, drone->pos_y);
+            map_render(swarm);
         }
-    }*/
+    }
 }
 
 int main(int argc, char *argv[]) {
@@ -174,6 +372,8 @@ int main(int argc, char *argv[]) {
         perror("Error opening the errors file");
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
 
     if (argc < 5) {
         LOG_TO_FILE(errors, "Invalid number of parameters");
@@ -196,16 +396,20 @@ int main(int argc, char *argv[]) {
 
 
     /* SETUP NCURSE */
-    initscr(); 
-    start_color();
-    cbreak(); 
-    noecho();
-    curs_set(0);
-
-    init_pair(1, COLOR_BLUE, COLOR_BLACK);
-    init_pair(2, COLOR_GREEN, COLOR_BLACK);
-    init_pair(3, COLOR_RED, COLOR_BLACK);
-    init_pair(4, COLOR_CYAN, COLOR_BLACK);
+    // In headless mode the map only consumes the state, nothing is drawn
+    headless = argc > 5 && strcmp(argv[5], HEADLESS_FLAG) == 0;
+    if (!headless) {
+        initscr(); 
+        start_color();
+        cbreak(); 
+        noecho();
+        curs_set(0);
+
+        init_pair(1, COLOR_BLUE, COLOR_BLACK);
+        init_pair(2, COLOR_GREEN, COLOR_BLACK);
+        init_pair(3, COLOR_RED, COLOR_BLACK);
+        init_pair(4, COLOR_CYAN, COLOR_BLACK);
+    }
 
     /* SETUP SIGNALS */
     struct sigaction sa;
@@ -233,13 +437,19 @@ int main(int argc, char *argv[]) {
 
     /* OPEN THE SHARED MEMORY */
     int mem_fd = open_shared_memory();
+    int world_fd = open_world_memory();
 
     // Retrive the dimension of the terminal
-    getmaxyx(stdscr, game.max_y, game.max_x);
+    if (headless) {
+        game.max_x = HEADLESS_MAP_WIDTH;
+        game.max_y = HEADLESS_MAP_HEIGHT;
+    } else {
+        getmaxyx(stdscr, game.max_y, game.max_x);
+    }
     // Send to the server the dimension
     write_to_server();
 
-    char buffer[256];
+    FrameBuffer obstacles_frame = {0}, targets_frame = {0};
     fd_set read_fds;
     struct timeval timeout;
 
@@ -249,6 +459,24 @@ int main(int argc, char *argv[]) {
     }
 
     /* LAUNCH THE MAP */
+    // The frames are drawn by their own thread, this one only reads the pipe
+    // The render thread inherits a mask without SIGWINCH, so the handler never interrupts ncurses
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGWINCH);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+    pthread_t render_thread;
+    int created = pthread_create(&render_thread, NULL, map_render_thread, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+    if (created != 0) {
+        perror("Error creating the thread for rendering the map");
+        LOG_TO_FILE(errors, "Error creating the thread for rendering the map");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+
     while (1) {
         FD_ZERO(&read_fds);
         FD_SET(server_read_fd, &read_fds);
@@ -267,22 +495,36 @@ int main(int argc, char *argv[]) {
         } else if (activity > 0) {
             // Check if the map process has sent him the map size
             if (FD_ISSET(server_read_fd, &read_fds)) {
-                LOG_TO_FILE(errors, "Entrato billy");
-                ssize_t bytes_read = read(server_read_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0'; // End the string
-                    //sscanf(buffer, "%d, %d", &game.max_x, &game.max_y);
-                    LOG_TO_FILE(errors, buffer);
+                // Obstacles and targets share the pipe: their chunks may interleave, each set has its own buffer
+                FrameHeader header;
+                FrameBuffer *frame = &obstacles_frame;
+                int n = frame_read_header(server_read_fd, &header);
+                if (n > 0) {
+                    if (header.type == 't') frame = &targets_frame;
+                    n = frame_receive(server_read_fd, &header, frame);
+                }
+                if (n == 0) {
+                    // The server closed the pipe, nothing more will come
+                    LOG_TO_FILE(debug, "The server closed the pipe of the sets");
+                    break;
+                }
+                if (n == 1) {
+                    if (!(frame->header.flags & FRAME_FLAG_SHARED) &&
+                        store_streamed(frame == &targets_frame ? WORLD_TARGETS : WORLD_OBSTACLES, frame) == -1) {
+                        LOG_TO_FILE(errors, "Error storing a streamed set");
+                    }
+                    LOG_EVENT(debug, "Received generation %u with %u objects", frame->header.generation, frame->header.count);
+                } else if (n == -1) {
+                    LOG_TO_FILE(errors, "Invalid frame from the server");
                 }
             }
-        } else {
-            map_render(drone);
         }
     }    
-    //map_render(drone);
+    free(obstacles_frame.objects);
+    free(targets_frame.objects);
 
     /* END PROGRAM*/
-    endwin();
+    if (!headless) endwin();
     // Close the file descriptor
     if (close(mem_fd) == -1) {
         perror("Close file descriptor");
@@ -293,7 +535,18 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     // Unmap the shared memory region
-    munmap(drone, sizeof(Drone));
+    munmap(swarm, swarm_size(swarm->count));
+    free(drones);
+    free(drone_cells);
+    // Unmap the world
+    close(world_fd);
+    munmap(world, world->size);
+    world_snapshot_free(&obstacles);
+    world_snapshot_free(&targets);
+    world_snapshot_free(&streamed.sets[WORLD_OBSTACLES]);
+    world_snapshot_free(&streamed.sets[WORLD_TARGETS]);
+    free(map_frame.cells);
+    free(map_frame.next);
 
     // Close the files
     fclose(debug);
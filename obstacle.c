@@ -1,41 +1,98 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <math.h>
 #include <sys/select.h>
 #include <errno.h>
 #include "cJSON/cJSON.h"
 #include "helper.h"
+#include "frame.h"
+#include "world.h"
+#include "prng.h"
+#include "ready.h"
+#include "heartbeat.h"
 
 FILE *debug, *errors;
 Game game;
-pid_t wd_pid;
 Drone *drone;
 int N_OBS;
 int obstacle_write_position_fd = -1;
+World *world;
+Heartbeat *heartbeat;
+uint32_t generation = 0;
+uint64_t seed;                          // World seed, every generation is drawn from a seed derived from it
+Prng prng;
+int streaming;                          // The sets go through the pipes instead of the world shared memory
+
+/**
+ * Stream the set through the pipe in chunks of FRAME_CHUNK_OBJECTS, drawn one chunk at a time,
+ * so the set can be larger than the world shared memory and the generator holds a chunk only.
+ * The coordinates are drawn in the same order as in the shared memory: a seed gives the same set.
+ */
+void stream_obstacles(uint32_t count) {
+    static WireObject chunk[FRAME_CHUNK_OBJECTS];
+    uint32_t sequence = 0, offset = 0;
+    do {
+        uint32_t size = count - offset < FRAME_CHUNK_OBJECTS ? count - offset : FRAME_CHUNK_OBJECTS;
+        for (uint32_t i = 0; i < size; i++) {
+            chunk[i].pos_x = prng_below(&prng, game.max_x-2) + 1;
+            chunk[i].pos_y = prng_below(&prng, game.max_y-2) + 1;
+            chunk[i].point = -1;
+            chunk[i].type = 'o';
+            chunk[i].reserved = 0;
+        }
+        if (frame_write_chunk(obstacle_write_position_fd, 'o', generation, sequence++, offset, count, chunk, size) == -1) {
+            LOG_TO_FILE(errors, "Error sending the obstacles to the server");
+            return;
+        }
+        offset += size;
+        // A large set can keep the pipe full for a while
+        heartbeat_beat(heartbeat, PROC_OBSTACLE);
+    } while (offset < count);
+}
 
 void generate_obstacles(){
-    Object obstacles[N_OBS];
-    char obstacleStr[1024] = "";
-    char temp[50];
-    char msg[100];
-    // create obstacles
-    for (int i = 0; i < N_OBS; i++){
-        // generates random coordinates
-        obstacles[i].pos_x = rand() % (game.max_x-2) + 1; 
-        obstacles[i].pos_y = rand() % (game.max_y-2) + 1;
-        obstacles[i].point = -1;
-        obstacles[i].type = 'o';
-        sprintf(temp, "%d,%d,%d,%c|", obstacles[i].pos_x, obstacles[i].pos_y, obstacles[i].point, obstacles[i].type);
-        strcat(obstacleStr, temp);
-    }
-    write(obstacle_write_position_fd, obstacleStr, strlen(obstacleStr));
-    obstacleStr[0] = '\0';
+    // The coordinates are drawn in [1, max - 2]: there is no room inside a smaller map
+    if (game.max_x <= 2 || game.max_y <= 2) {
+        LOG_EVENT(errors, "Map of %d x %d too small for the obstacles", game.max_x, game.max_y);
+        return;
+    }
+    uint32_t wanted = N_OBS > 0 ? (uint32_t)N_OBS : 0;
+    uint64_t generation_seed = prng_generation_seed(seed, PRNG_STREAM_OBSTACLES, generation + 1);
+    prng_seed(&prng, generation_seed);
+    uint32_t count;
+    if (streaming) {
+        count = wanted;
+        generation++;
+        stream_obstacles(count);
+    } else {
+        // create obstacles straight in the world shared memory
+        int32_t *x = world_x(world, WORLD_OBSTACLES), *y = world_y(world, WORLD_OBSTACLES), *point = world_point(world, WORLD_OBSTACLES);
+        count = wanted < world->sets[WORLD_OBSTACLES].capacity ? wanted : world->sets[WORLD_OBSTACLES].capacity;
+        world_write_begin(world, WORLD_OBSTACLES);
+        for (uint32_t i = 0; i < count; i++){
+            // generates random coordinates
+            x[i] = prng_below(&prng, game.max_x-2) + 1; 
+            y[i] = prng_below(&prng, game.max_y-2) + 1;
+            point[i] = -1;
+        }
+        world_write_end(world, WORLD_OBSTACLES, ++generation, count);
+    }
+
+    // Enough to regenerate this set alone
+    LOG_EVENT(debug, "Generation %u of the obstacles: world seed %llu, generation seed %llu, map %d x %d",
+              generation, seed, generation_seed, game.max_x, game.max_y);
+    // Only the header goes through the server, the readers copy the set from the shared memory
+    if (!streaming && frame_notify(obstacle_write_position_fd, 'o', generation, count) == -1) {
+        LOG_TO_FILE(errors, "Error sending the obstacles to the server");
+    }
 }
 
 int open_shared_memory() {
@@ -60,12 +117,30 @@ int open_shared_memory() {
     return mem_fd;
 }
 
-void signal_handler(int sig, siginfo_t* info, void *context) {
-    if (sig == SIGUSR1) {
-        wd_pid = info->si_pid;
-        LOG_TO_FILE(debug, "Signal SIGUSR1 received from WATCHDOG");
-        kill(wd_pid, SIGUSR1);
+int open_world_memory() {
+    int world_fd = shm_open(WORLD_SHARED_MEMORY, O_RDWR, 0666);
+    struct stat info;
+    if (world_fd == -1 || fstat(world_fd, &info) == -1) {
+        perror("Error opening the world shared memory");
+        LOG_TO_FILE(errors, "Error opening the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+    world = (World *)mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, world_fd, 0);
+    if (world == MAP_FAILED || world->magic != WORLD_MAGIC) {
+        perror("Error mapping the world shared memory");
+        LOG_TO_FILE(errors, "Error mapping the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
     }
+    return world_fd;
+}
+
+void signal_handler(int sig, siginfo_t* info, void *context) {
 
     if (sig == SIGUSR2) {
         LOG_TO_FILE(debug, "Shutting down by the WATCHDOG");
@@ -74,13 +149,15 @@ void signal_handler(int sig, siginfo_t* info, void *context) {
         fclose(debug);
         exit(EXIT_SUCCESS);
     }
-    if (sig == SIGTERM) {
-        if (obstacle_write_position_fd > 0) {
-            LOG_TO_FILE(debug, "Generating new obstacles position");
-            generate_obstacles();
-        } else {
-            printf("NOT SET\n");
-        }
+}
+
+// Request of the server: the map size "width, height" after a resize, or GENERATION_REQUEST
+void handle_request(const char *request) {
+    if (sscanf(request, "%d, %d", &game.max_x, &game.max_y) == 2) {
+        generate_obstacles();
+    } else if (strncmp(request, GENERATION_REQUEST, strlen(GENERATION_REQUEST) - 1) == 0 && game.max_x > 2 && game.max_y > 2) {
+        LOG_TO_FILE(debug, "Generating new obstacles position");
+        generate_obstacles();
     }
 }
 
@@ -95,6 +172,8 @@ int main(int argc, char* argv[]) {
         perror("fopen");
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
     
     if (argc < 3) {
         LOG_TO_FILE(errors, "Invalid number of parameters");
@@ -112,6 +191,10 @@ int main(int argc, char* argv[]) {
 
     /* IMPORT CONFIGURATION PARAMETERS FROM THE MAIN */
     N_OBS = atoi(argv[3]);
+    seed = argc > 4 ? strtoull(argv[4], NULL, 10) : 0;
+    // Transport of the sets chosen in appsettings.json, the world shared memory by default
+    const char *transport = getenv(WORLD_TRANSPORT_VARIABLE);
+    streaming = transport != NULL && strcmp(transport, WORLD_TRANSPORT_STREAM) == 0;
 
     /* SETTING THE SIGNALS */
     struct sigaction sa;
@@ -119,15 +202,6 @@ int main(int argc, char* argv[]) {
     sa.sa_sigaction = signal_handler;
     sigemptyset(&sa.sa_mask);
 
-    // Set the signal handler for SIGUSR1
-    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
-        perror("Error in sigaction(SIGURS1)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS1)");
-        // Close the files
-        fclose(debug);
-        fclose(errors);
-        exit(EXIT_FAILURE);
-    }
     // Set the signal handler for SIGUSR2
     if(sigaction(SIGUSR2, &sa, NULL) == -1){
         perror("Error in sigaction(SIGURS2)");
@@ -137,20 +211,31 @@ int main(int argc, char* argv[]) {
         fclose(errors);
         exit(EXIT_FAILURE);
     }
-    // Set the signal handler for SIGTERM
-    if(sigaction(SIGTERM, &sa, NULL) == -1){
-        perror("Error in sigaction(SIGTERM)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGTERM)");
+
+    /* OPEN SHARED MEMORY */
+    int mem_fd = open_shared_memory();
+    int world_fd = open_world_memory();
+
+    /* OPEN THE HEARTBEAT */
+    heartbeat = heartbeat_open();
+    if (heartbeat == NULL) {
+        perror("Error opening the heartbeat shared memory");
+        LOG_TO_FILE(errors, "Error opening the heartbeat shared memory");
         // Close the files
         fclose(debug);
         fclose(errors);
         exit(EXIT_FAILURE);
     }
+    heartbeat_beat(heartbeat, PROC_OBSTACLE);
 
-    /* OPEN SHARED MEMORY */
-    int mem_fd = open_shared_memory();
+    /* REPORT TO THE LAUNCHER */
+    if (ready_notify(PROC_OBSTACLE) == -1) {
+        perror("Error reporting to the launcher");
+        LOG_TO_FILE(errors, "Error reporting to the launcher");
+    }
     
     char buffer[256];
+    size_t length = 0;                      // Bytes of an incomplete request at the start of the buffer
     fd_set read_fds;
     struct timeval timeout;
 
@@ -163,8 +248,10 @@ int main(int argc, char* argv[]) {
         FD_ZERO(&read_fds);
         FD_SET(obstacle_read_map_fd, &read_fds);
 
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        // The loop beats at every iteration, so it never waits longer than HEARTBEAT_INTERVAL_MS
+        heartbeat_beat(heartbeat, PROC_OBSTACLE);
+        timeout.tv_sec = HEARTBEAT_INTERVAL_MS / 1000;
+        timeout.tv_usec = HEARTBEAT_INTERVAL_MS % 1000 * 1000;
         int activity;
         do {
             activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
@@ -175,13 +262,23 @@ int main(int argc, char* argv[]) {
             LOG_TO_FILE(errors, "Error in select which pipe reads");
             break;
         } else if (activity > 0) {
-            // Check if the map process has sent him the map size
+            // Check if the server has sent him the map size or a generation request, one per line
             if (FD_ISSET(obstacle_read_map_fd, &read_fds)) {
-                ssize_t bytes_read = read(obstacle_read_map_fd, buffer, sizeof(buffer) - 1);
+                ssize_t bytes_read = read(obstacle_read_map_fd, buffer + length, sizeof(buffer) - 1 - length);
+                if (bytes_read == 0) break;
                 if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0'; // End the string
-                    sscanf(buffer, "%d, %d", &game.max_x, &game.max_y);
-                    generate_obstacles();
+                    length += bytes_read;
+                    buffer[length] = '\0'; // End the string
+                    char *request = buffer, *end;
+                    while ((end = strchr(request, '\n')) != NULL) {
+                        *end = '\0';
+                        handle_request(request);
+                        request = end + 1;
+                    }
+                    // Keep the incomplete request for the next read, a line that fills the buffer is dropped
+                    length -= request - buffer;
+                    if (length == sizeof(buffer) - 1) length = 0;
+                    memmove(buffer, request, length);
                 }
             }
         }
@@ -196,6 +293,9 @@ int main(int argc, char* argv[]) {
         fclose(errors); 
         exit(EXIT_FAILURE);
     }
+    // Unmap the world
+    close(world_fd);
+    munmap(world, world->size);
     // Unmap the shared memory region
     munmap(drone, sizeof(Drone));
 
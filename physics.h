@@ -0,0 +1,149 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <math.h>
+#include "helper.h"
+#include "repulsion.h"
+#include "grid.h"
+
+/**
+ * Dynamics of the drone, shared by the drone process and the headless benchmark.
+ * It only depends on the size of the map, on the obstacles that repel the drone and on
+ * the targets it can reach. Both sets are indexed by a uniform grid with cells of rho0,
+ * so each tick only looks at the cells around the drone whatever the number of objects.
+ */
+
+#define TARGET_RADIUS 1.0                   // Distance within which a target is reached
+#define GRID_MAX_RUNS 8                     // Rows of cells visited by one query
+
+typedef struct {
+    SpatialGrid grid;
+    unsigned char *reached;                 // Indexed by the position of the target in the set
+    int left;                               // Targets not reached yet
+    uint32_t generation;                    // Generation of the set, reported to the server once every target is reached
+} TargetSet;
+
+float rho0 = 2, rho1 = 0.5, rho2 = 2, eta = 40;
+Game game;
+SpatialGrid *obstacle_grid = NULL;          // Obstacles taken into account by the repulsive force
+TargetSet *target_set = NULL;               // Targets the drone can reach
+RepulsionKernel repulsion_kernel = NULL;    // Chosen at the first use if not set
+int physics_use_grid = 1;                   // When 0 every obstacle is evaluated at each tick
+
+float calculate_friction_force(float velocity) {
+    return -FRICTION_COEFFICIENT * velocity;
+}
+
+// Summed repulsion of the obstacles within rho0 of the drone
+void calculate_repulsive_force(Drone *drone, float *fx, float *fy) {
+    *fx = 0;
+    *fy = 0;
+    if (obstacle_grid == NULL || obstacle_grid->items.count == 0) return;
+    if (repulsion_kernel == NULL) repulsion_kernel = repulsion_select(NULL);
+
+    RepulsionParameters parameters = {drone->pos_x, drone->pos_y, fabsf(drone->vel_x), fabsf(drone->vel_y), rho0, eta, MAX_FREP};
+    const ObstacleBuffer *items = &obstacle_grid->items;
+    if (!physics_use_grid) {
+        repulsion_kernel(&parameters, items->x, items->y, items->count, fx, fy);
+        return;
+    }
+
+    int first[GRID_MAX_RUNS], last[GRID_MAX_RUNS];
+    int runs = grid_query(obstacle_grid, drone->pos_x, drone->pos_y, rho0, first, last, GRID_MAX_RUNS);
+    for (int i = 0; i < runs; i++) {
+        float run_x, run_y;
+        repulsion_kernel(&parameters, items->x + first[i], items->y + first[i], last[i] - first[i], &run_x, &run_y);
+        *fx += run_x;
+        *fy += run_y;
+    }
+}
+
+/**
+ * Mark the targets within TARGET_RADIUS of the drone as reached, returns how many were reached now.
+ * Several drones can be advanced at once: a target is claimed with an atomic exchange, so it is
+ * counted once even when two drones reach it in the same tick.
+ */
+int reach_targets(Drone *drone) {
+    if (target_set == NULL || __atomic_load_n(&target_set->left, __ATOMIC_RELAXED) == 0) return 0;
+
+    int first[GRID_MAX_RUNS], last[GRID_MAX_RUNS], reached = 0;
+    const SpatialGrid *grid = &target_set->grid;
+    int runs = grid_query(grid, drone->pos_x, drone->pos_y, TARGET_RADIUS, first, last, GRID_MAX_RUNS);
+    for (int i = 0; i < runs; i++) {
+        for (int j = first[i]; j < last[i]; j++) {
+            float dx = drone->pos_x - grid->items.x[j], dy = drone->pos_y - grid->items.y[j];
+            if (dx * dx + dy * dy > TARGET_RADIUS * TARGET_RADIUS ||
+                __atomic_exchange_n(&target_set->reached[grid->index[j]], 1, __ATOMIC_RELAXED)) continue;
+            __atomic_fetch_sub(&target_set->left, 1, __ATOMIC_RELAXED);
+            reached++;
+        }
+    }
+    return reached;
+}
+
+void update_drone_position(Drone *drone, float dt) {
+    float fx_obs = 0;
+    float fy_obs = 0;
+    calculate_repulsive_force(drone, &fx_obs, &fy_obs);
+
+    float frictionForceX = calculate_friction_force(drone->vel_x);
+    float frictionForceY = calculate_friction_force(drone->vel_y);
+    
+    float accelerationX = (drone->force_x + frictionForceX + fx_obs) / MASS;
+    float accelerationY = (drone->force_y + frictionForceY + fy_obs) / MASS;
+
+    drone->vel_x += accelerationX * dt;
+    drone->vel_y += accelerationY * dt;
+    drone->pos_x += drone->vel_x * dt + 0.5 * accelerationX * dt * dt;
+    drone->pos_y += drone->vel_y * dt + 0.5 * accelerationY * dt * dt;
+
+    if (drone->pos_x < 0) { drone->pos_x = 0; drone->vel_x = 0; drone->force_x = 0;}
+    if (drone->pos_x >= game.max_x) { drone->pos_x = game.max_x - 1; drone->vel_x = 0; drone->force_x = 0;}
+    if (drone->pos_y < 0) {drone->pos_y = 0; drone->vel_y = 0; drone->force_y = 0;}
+    if (drone->pos_y >= game.max_y) { drone->pos_y = game.max_y - 1; drone->vel_y = 0; drone->force_y = 0;}
+}
+
+void handle_key_pressed(char key, Drone *drone) {
+    switch (key) {
+        case 'w': case 'W':
+            drone->force_x -= 0.25;
+            drone->force_y -= 0.25;
+            break;
+        case 'e': case 'E':
+            drone->force_x -= 0;
+            drone->force_y -= 0.5;
+            break;
+        case 'r': case 'R':
+            drone->force_x += 0.25;
+            drone->force_y -= 0.25;
+            break;
+        case 's': case 'S':
+            drone->force_x -= 0.5;
+            drone->force_y += 0;
+            break;
+        case 'd': case 'D':
+            drone->force_x = 0;
+            drone->force_y = 0;
+            break;
+        case 'f': case 'F':
+            drone->force_x += 0.5;
+            drone->force_y += 0;
+            break;
+        case 'x': case 'X':
+            drone->force_x -= 0.25;
+            drone->force_y += 0.25;
+            break;
+        case 'c': case 'C':
+            drone->force_x += 0;
+            drone->force_y += 0.5;
+            break;
+        case 'v': case 'V':
+            drone->force_x += 0.25;
+            drone->force_y += 0.25;
+            break;
+        default:
+            break;
+    }
+}
+
+#endif
@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "physics.h"
+#include "physics_pool.h"
+
+#define DEFAULT_TICKS 1000000               // Number of ticks simulated when not given
+#define DEFAULT_OBSTACLES 13                // Number of obstacles when not given
+#define DEFAULT_MAP_X 100                   // Size of the map when not given
+#define DEFAULT_MAP_Y 40
+#define DEFAULT_DRONES 1                    // Number of drones when not given
+#define DEFAULT_SCRIPT "ffffrrreeewwwsssxxxcccvvvbdd"
+#define KEY_PERIOD 20                       // Ticks between two keys of the script
+
+/**
+ * Headless benchmark of update_drone_position: no shared memory, no pipes, no ncurses.
+ * Usage: ./physics_bench [ticks] [obstacles] [map_x] [map_y] [script] [kernel] [index] [drones] [workers]
+ * The script is a sequence of keys applied to every drone one every KEY_PERIOD ticks, in a loop.
+ * The kernel of the repulsive force is "avx2", "sse" or "scalar", the fastest by default.
+ * The index is "grid" (the default, as in the drone) or "linear" to evaluate every obstacle.
+ * The ticks are run by the pool of the drone process, with the number of cores when workers is 0.
+ * The first drone starts in the middle of the map and the others at fixed random places.
+ * The obstacles are placed with a fixed generator, so two runs with the same
+ * arguments must print the same checksum, whatever the number of workers.
+ */
+
+// Fixed linear congruential generator, independent from the libc one
+uint32_t next_random(uint32_t *state) {
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+// FNV-1a of the bytes of the value, chained to the previous hash
+uint64_t hash_float(uint64_t hash, float value) {
+    unsigned char bytes[sizeof(float)];
+    memcpy(bytes, &value, sizeof(float));
+    for (size_t i = 0; i < sizeof(float); i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+int main(int argc, char *argv[]) {
+    long ticks = argc > 1 ? atol(argv[1]) : DEFAULT_TICKS;
+    int n_obs = argc > 2 ? atoi(argv[2]) : DEFAULT_OBSTACLES;
+    game.max_x = argc > 3 ? atoi(argv[3]) : DEFAULT_MAP_X;
+    game.max_y = argc > 4 ? atoi(argv[4]) : DEFAULT_MAP_Y;
+    const char *script = argc > 5 ? argv[5] : DEFAULT_SCRIPT;
+    const char *kernel = argc > 6 ? argv[6] : NULL;
+    const char *index = argc > 7 ? argv[7] : "grid";
+    int n_drones = argc > 8 ? atoi(argv[8]) : DEFAULT_DRONES;
+    int workers = argc > 9 ? atoi(argv[9]) : 0;
+    size_t script_length = strlen(script);
+
+    repulsion_kernel = repulsion_select(kernel);
+    physics_use_grid = strcmp(index, "linear") != 0;
+    if (ticks <= 0 || n_obs < 0 || game.max_x < 3 || game.max_y < 3 || repulsion_kernel == NULL || n_drones < 1 || workers < 0) {
+        fprintf(stderr, "Usage: %s [ticks] [obstacles] [map_x] [map_y] [script] [avx2|sse|scalar] [grid|linear] [drones] [workers]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* PLACE THE OBSTACLES */
+    ObstacleBuffer obstacles = {0};
+    if (obstacle_buffer_reserve(&obstacles, n_obs) == -1) {
+        perror("Error allocating the obstacles");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t state = 42;
+    for (int i = 0; i < n_obs; i++) {
+        obstacles.x[i] = next_random(&state) % (game.max_x - 2) + 1;
+        obstacles.y[i] = next_random(&state) % (game.max_y - 2) + 1;
+    }
+    SpatialGrid grid;
+    uint64_t build_start = monotonic_ns();
+    if (grid_build(&grid, obstacles.x, obstacles.y, n_obs, game.max_x, game.max_y, rho0) == -1) {
+        perror("Error building the grid of the obstacles");
+        exit(EXIT_FAILURE);
+    }
+    uint64_t build_time = monotonic_ns() - build_start;
+    obstacle_grid = &grid;
+
+    /* RUN THE PHYSICS */
+    Drone *drones = calloc(n_drones, sizeof(Drone));
+    PhysicsPool pool;
+    if (drones == NULL || physics_pool_init(&pool, n_drones, workers) == -1) {
+        perror("Error starting the physics");
+        exit(EXIT_FAILURE);
+    }
+    drones[0].pos_x = game.max_x / 2;
+    drones[0].pos_y = game.max_y / 2;
+    for (int i = 1; i < n_drones; i++) {
+        drones[i].pos_x = next_random(&state) % (game.max_x - 2) + 1;
+        drones[i].pos_y = next_random(&state) % (game.max_y - 2) + 1;
+    }
+
+    // The first drone is hashed at every tick, the others once at the end
+    uint64_t checksum = 14695981039346656037ULL;
+    uint64_t start = monotonic_ns();
+    for (long tick = 0; tick < ticks; tick++) {
+        if (script_length > 0 && tick % KEY_PERIOD == 0) {
+            for (int i = 0; i < n_drones; i++) handle_key_pressed(script[(tick / KEY_PERIOD) % script_length], &drones[i]);
+        }
+        physics_pool_tick(&pool, drones, n_drones, T);
+        checksum = hash_float(checksum, drones[0].pos_x);
+        checksum = hash_float(checksum, drones[0].pos_y);
+    }
+    uint64_t elapsed = monotonic_ns() - start;
+    for (int i = 1; i < n_drones; i++) {
+        checksum = hash_float(checksum, drones[i].pos_x);
+        checksum = hash_float(checksum, drones[i].pos_y);
+    }
+    Drone drone = drones[0];
+
+    /* REPORT */
+    printf("ticks:          %ld\n", ticks);
+    printf("obstacles:      %d\n", n_obs);
+    printf("map:            %d x %d\n", game.max_x, game.max_y);
+    printf("kernel:         %s\n", repulsion_kernel == repulsion_scalar ? "scalar" : (kernel != NULL ? kernel : "default"));
+    printf("index:          %s (built in %.1f us)\n", physics_use_grid ? "grid" : "linear", build_time / 1e3);
+    printf("drones:         %d on %d workers\n", n_drones, pool.workers);
+    printf("ticks/s:        %.0f\n", ticks / (elapsed / 1e9));
+    printf("ns/tick:        %.2f\n", (double)elapsed / ticks);
+    printf("ns/drone tick:  %.2f\n", (double)elapsed / ticks / n_drones);
+    printf("final state:    pos (%.6f, %.6f) vel (%.6f, %.6f)\n", drone.pos_x, drone.pos_y, drone.vel_x, drone.vel_y);
+    printf("checksum:       %016llx\n", (unsigned long long)checksum);
+
+    physics_pool_destroy(&pool);
+    free(drones);
+    grid_free(&grid);
+    obstacle_buffer_free(&obstacles);
+    return 0;
+}
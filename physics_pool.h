@@ -0,0 +1,207 @@
+#ifndef PHYSICS_POOL_H
+#define PHYSICS_POOL_H
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "physics.h"
+
+#define POOL_CHUNK 32                       // Drones in one unit of work
+#define POOL_MAX_WORKERS 64                 // Largest pool, whatever the number of cores
+
+/**
+ * Executor of the physics ticks: the drones are split in chunks of POOL_CHUNK and every tick is
+ * run by a pool of workers, the calling thread being the first one. Each worker gets a contiguous
+ * share of the chunks and takes them front to back; once its share is over it steals the chunks
+ * left in the shares of the others, so a worker whose drones are near many obstacles does not
+ * hold back the tick. The owner and the thieves take chunks from the same atomic cursor, so a
+ * chunk is run exactly once without locks.
+ * A barrier starts and one ends every tick: every drone runs tick k before any drone runs k + 1.
+ * Each drone only reads the shared sets, the targets are marked with atomics (reach_targets),
+ * so the result of a tick does not depend on the number of workers.
+ */
+typedef struct {
+    atomic_int next;                        // Next chunk of the share, taken by the owner and the thieves
+    int end;                                // First chunk after the share
+} __attribute__((aligned(64))) PoolShare;
+
+typedef struct {
+    int workers;                            // Threads running a tick, the caller included
+    pthread_t *threads;                     // The workers after the first one
+    PoolShare *shares;                      // One per worker
+    pthread_barrier_t start, end;
+    // Gate the workers wait at before their first tick, so a pool that failed to start can release them
+    pthread_mutex_t lock;
+    pthread_cond_t launched;
+    int launch;                             // 0 while the workers are started, 1 once they all are, -1 if one failed
+    // Tick being run, set by the caller before the start barrier
+    Drone *drones;
+    int count;
+    float dt;
+    atomic_int reached;                     // Targets reached during the tick
+    int stop;                               // Set before the start barrier to end the workers
+} PhysicsPool;
+
+typedef struct {
+    PhysicsPool *pool;
+    int id;
+} PoolWorker;
+
+// Run the chunks of the shares, starting from the worker's own
+static void physics_pool_work(PhysicsPool *pool, int id) {
+    int reached = 0;
+    for (int k = 0; k < pool->workers; k++) {
+        PoolShare *share = &pool->shares[(id + k) % pool->workers];
+        int chunk;
+        while ((chunk = atomic_fetch_add_explicit(&share->next, 1, memory_order_relaxed)) < share->end) {
+            int first = chunk * POOL_CHUNK;
+            int last = first + POOL_CHUNK < pool->count ? first + POOL_CHUNK : pool->count;
+            for (int i = first; i < last; i++) {
+                update_drone_position(&pool->drones[i], pool->dt);
+                reached += reach_targets(&pool->drones[i]);
+            }
+        }
+    }
+    if (reached > 0) atomic_fetch_add_explicit(&pool->reached, reached, memory_order_relaxed);
+}
+
+static void *physics_pool_thread(void *data) {
+    PoolWorker *worker = data;
+    PhysicsPool *pool = worker->pool;
+    pthread_mutex_lock(&pool->lock);
+    while (pool->launch == 0) pthread_cond_wait(&pool->launched, &pool->lock);
+    int launched = pool->launch > 0;
+    pthread_mutex_unlock(&pool->lock);
+
+    while (launched) {
+        pthread_barrier_wait(&pool->start);
+        if (pool->stop) break;
+        physics_pool_work(pool, worker->id);
+        pthread_barrier_wait(&pool->end);
+    }
+    free(worker);
+    return NULL;
+}
+
+// Open the gate of the workers: 1 lets them run the ticks, -1 makes them leave before the first one
+static void physics_pool_launch(PhysicsPool *pool, int launch) {
+    pthread_mutex_lock(&pool->lock);
+    pool->launch = launch;
+    pthread_cond_broadcast(&pool->launched);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Undo a start that failed after `started` workers: they are released and joined, then everything is freed
+static int physics_pool_abort(PhysicsPool *pool, int started) {
+    physics_pool_launch(pool, -1);
+    for (int i = 0; i < started; i++) pthread_join(pool->threads[i], NULL);
+    pthread_barrier_destroy(&pool->start);
+    pthread_barrier_destroy(&pool->end);
+    pthread_cond_destroy(&pool->launched);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->threads);
+    free(pool->shares);
+    memset(pool, 0, sizeof(*pool));
+    return -1;
+}
+
+/**
+ * Start a pool for `count` drones with `workers` threads, the number of online cores when 0.
+ * No more workers than chunks are started, a single one runs the ticks in the caller.
+ * The unit of work is a chunk of drones, never the obstacles around one drone: up to POOL_CHUNK
+ * drones run on one thread however dense the obstacle field, which keeps the forces of a drone
+ * summed in the same order for any number of workers. Returns -1 on errors.
+ */
+static int physics_pool_init(PhysicsPool *pool, int count, int workers) {
+    memset(pool, 0, sizeof(*pool));
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int chunks = (count + POOL_CHUNK - 1) / POOL_CHUNK;
+    if (workers > chunks) workers = chunks;
+    if (workers > POOL_MAX_WORKERS) workers = POOL_MAX_WORKERS;
+    if (workers < 1) workers = 1;
+    pool->workers = workers;
+
+    // The kernel is chosen lazily at the first use, before the workers can race on it
+    if (repulsion_kernel == NULL) repulsion_kernel = repulsion_select(NULL);
+
+    pool->shares = aligned_alloc(64, sizeof(PoolShare) * workers);
+    if (pool->shares == NULL) return -1;
+    if (workers == 1) return 0;
+
+    pool->threads = malloc(sizeof(pthread_t) * (workers - 1));
+    if (pool->threads == NULL || pthread_barrier_init(&pool->start, NULL, workers) != 0) {
+        free(pool->threads);
+        free(pool->shares);
+        memset(pool, 0, sizeof(*pool));
+        return -1;
+    }
+    if (pthread_barrier_init(&pool->end, NULL, workers) != 0) {
+        pthread_barrier_destroy(&pool->start);
+        free(pool->threads);
+        free(pool->shares);
+        memset(pool, 0, sizeof(*pool));
+        return -1;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->launched, NULL);
+    for (int i = 1; i < workers; i++) {
+        PoolWorker *worker = malloc(sizeof(PoolWorker));
+        if (worker == NULL) return physics_pool_abort(pool, i - 1);
+        worker->pool = pool;
+        worker->id = i;
+        if (pthread_create(&pool->threads[i - 1], NULL, physics_pool_thread, worker) != 0) {
+            free(worker);
+            return physics_pool_abort(pool, i - 1);
+        }
+    }
+    physics_pool_launch(pool, 1);
+    return 0;
+}
+
+// Advance every drone by one tick of dt, returns how many targets were reached
+static int physics_pool_tick(PhysicsPool *pool, Drone *drones, int count, float dt) {
+    // A single worker runs the tick in the caller, with nothing to share
+    if (pool->workers == 1) {
+        int reached = 0;
+        for (int i = 0; i < count; i++) {
+            update_drone_position(&drones[i], dt);
+            reached += reach_targets(&drones[i]);
+        }
+        return reached;
+    }
+
+    int chunks = (count + POOL_CHUNK - 1) / POOL_CHUNK;
+    pool->drones = drones;
+    pool->count = count;
+    pool->dt = dt;
+    atomic_store_explicit(&pool->reached, 0, memory_order_relaxed);
+    for (int i = 0; i < pool->workers; i++) {
+        atomic_store_explicit(&pool->shares[i].next, chunks * i / pool->workers, memory_order_relaxed);
+        pool->shares[i].end = chunks * (i + 1) / pool->workers;
+    }
+
+    // The barriers publish the job to the workers and their drones back to the caller
+    pthread_barrier_wait(&pool->start);
+    physics_pool_work(pool, 0);
+    pthread_barrier_wait(&pool->end);
+    return atomic_load_explicit(&pool->reached, memory_order_relaxed);
+}
+
+// Stop the workers and free the pool
+static void physics_pool_destroy(PhysicsPool *pool) {
+    if (pool->workers > 1) {
+        pool->stop = 1;
+        pthread_barrier_wait(&pool->start);
+        for (int i = 0; i < pool->workers - 1; i++) pthread_join(pool->threads[i], NULL);
+        pthread_barrier_destroy(&pool->start);
+        pthread_barrier_destroy(&pool->end);
+        pthread_cond_destroy(&pool->launched);
+        pthread_mutex_destroy(&pool->lock);
+    }
+    free(pool->threads);
+    free(pool->shares);
+    memset(pool, 0, sizeof(*pool));
+}
+
+#endif
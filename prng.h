@@ -0,0 +1,59 @@
+#ifndef PRNG_H
+#define PRNG_H
+
+#include <stdint.h>
+
+#define PRNG_STREAM_OBSTACLES 1             // Each generator draws from its own stream of the world seed
+#define PRNG_STREAM_TARGETS 2
+
+/**
+ * xoshiro256** generator, one private state per generator instead of the global rand().
+ * Every generation of a set is drawn from its own seed, derived from the world seed, the stream
+ * and the generation number, so any generation can be regenerated alone from the logged seed.
+ */
+typedef struct {
+    uint64_t s[4];
+} Prng;
+
+// SplitMix64 step, used to expand a 64-bit seed into a full state
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline void prng_seed(Prng *prng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) prng->s[i] = splitmix64(&seed);
+}
+
+// Seed of one generation of a stream
+static inline uint64_t prng_generation_seed(uint64_t seed, uint64_t stream, uint64_t generation) {
+    uint64_t state = seed ^ (stream << 32 | generation);
+    splitmix64(&state);
+    return splitmix64(&state);
+}
+
+static inline uint64_t prng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t prng_next(Prng *prng) {
+    uint64_t *s = prng->s;
+    uint64_t result = prng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = prng_rotl(s[3], 45);
+    return result;
+}
+
+// Integer in [0, bound) with a multiply and a shift instead of a division, the bias is below bound / 2^32
+static inline uint32_t prng_below(Prng *prng, uint32_t bound) {
+    return (uint32_t)(((prng_next(prng) >> 32) * (uint64_t)bound) >> 32);
+}
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef READY_H
+#define READY_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define READY_SOCKET_VARIABLE "ARP_READY_SOCKET"   // Environment variable with the name of the launcher's socket
+#define READY_MAGIC 0x59445241u             // "ARDY" in little endian
+#define READY_TIMEOUT_MS 10000              // Time a component has to report that it is ready
+
+/**
+ * Startup handshake: the launcher binds a datagram socket in the abstract namespace and
+ * exports its name, every component sends one ReadyMessage with its slot (PROC_SERVER to
+ * PROC_INPUT) and its pid once it has set up everything the others depend on.
+ * The launcher starts the next components as soon as the ones they need have reported.
+ */
+typedef struct {
+    uint32_t magic;
+    int32_t component;
+    int32_t pid;
+} ReadyMessage;
+
+// Address of a socket in the abstract namespace: a leading NUL byte, then the name
+static socklen_t ready_address(const char *name, struct sockaddr_un *address) {
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+    size_t length = strlen(name);
+    if (length > sizeof(address->sun_path) - 1) length = sizeof(address->sun_path) - 1;
+    memcpy(address->sun_path + 1, name, length);
+    return offsetof(struct sockaddr_un, sun_path) + 1 + length;
+}
+
+// Create the launcher's socket and export its name to the children, returns -1 on errors
+static int ready_listen() {
+    char name[64];
+    snprintf(name, sizeof(name), "arp-ready-%d", getpid());
+    struct sockaddr_un address;
+    socklen_t length = ready_address(name, &address);
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    if (bind(fd, (struct sockaddr *)&address, length) == -1 || setenv(READY_SOCKET_VARIABLE, name, 1) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Tell the launcher that this component is ready, nothing is sent when it was not started by the launcher
+static int ready_notify(int component) {
+    const char *name = getenv(READY_SOCKET_VARIABLE);
+    if (name == NULL) return 0;
+    struct sockaddr_un address;
+    socklen_t length = ready_address(name, &address);
+    ReadyMessage message = {READY_MAGIC, component, getpid()};
+
+    int fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    ssize_t sent = sendto(fd, &message, sizeof(message), 0, (struct sockaddr *)&address, length);
+    close(fd);
+    return sent == sizeof(message) ? 0 : -1;
+}
+
+/**
+ * Wait until every component in [first, last] has reported, their pids are stored in pids.
+ * Returns 0 when they are all ready, -1 on errors or when timeout_ms elapses first.
+ */
+static int ready_wait(int fd, pid_t *pids, int first, int last, int timeout_ms) {
+    int missing = last - first + 1;
+    for (int i = first; i <= last; i++) pids[i] = 0;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    int64_t deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + timeout_ms;
+    while (missing > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        int64_t left = deadline - (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+        struct pollfd entry = {fd, POLLIN, 0};
+        int n = poll(&entry, 1, left > 0 ? (int)left : 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        ReadyMessage message;
+        ssize_t received;
+        while ((received = recv(fd, &message, sizeof(message), MSG_DONTWAIT)) == sizeof(message)) {
+            if (message.magic != READY_MAGIC || message.component < first || message.component > last ||
+                pids[message.component] != 0) continue;
+            pids[message.component] = message.pid;
+            missing--;
+        }
+        if (received == -1 && errno != EAGAIN && errno != EINTR) return -1;
+    }
+    return 0;
+}
+
+#endif
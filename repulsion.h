@@ -0,0 +1,190 @@
+#ifndef REPULSION_H
+#define REPULSION_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Batched repulsive force of a set of obstacles on the drone.
+ * The obstacles are stored as a structure of arrays, so that the kernel can load 4 (SSE)
+ * or 8 (AVX2) of them at a time. For each obstacle within rho0 the force is
+ *      eta * (1 / rho - 1 / rho0) * (dx / rho, dy / rho) * (|vx|, |vy|)
+ * with rho never below 0.5, clamped to +-MAX_FREP on each axis, and then summed.
+ * The direction uses dx / rho and dy / rho instead of cos and sin of atan2, so no
+ * trigonometric function is evaluated.
+ */
+
+#define REPULSION_MIN_RHO 0.5f              // Distance below which the repulsion stops growing
+
+typedef struct {
+    float *x, *y;                           // Coordinates of the obstacles
+    int count, capacity;
+} ObstacleBuffer;
+
+typedef struct {
+    float pos_x, pos_y;                     // Position of the drone
+    float speed_x, speed_y;                 // Absolute value of the velocity of the drone
+    float rho0, eta, max_force;
+} RepulsionParameters;
+
+typedef void (*RepulsionKernel)(const RepulsionParameters *, const float *, const float *, int, float *, float *);
+
+// Make room for at least `capacity` obstacles, the content is not preserved
+static int obstacle_buffer_reserve(ObstacleBuffer *buffer, int capacity) {
+    if (capacity <= buffer->capacity) return 0;
+    // Rounded to a multiple of 8 and aligned for the vector loads
+    size_t size = ((size_t)capacity + 7) / 8 * 8 * sizeof(float);
+    float *x = aligned_alloc(32, size), *y = aligned_alloc(32, size);
+    if (x == NULL || y == NULL) {
+        free(x);
+        free(y);
+        return -1;
+    }
+    free(buffer->x);
+    free(buffer->y);
+    buffer->x = x;
+    buffer->y = y;
+    buffer->capacity = (int)(size / sizeof(float));
+    return 0;
+}
+
+static void obstacle_buffer_free(ObstacleBuffer *buffer) {
+    free(buffer->x);
+    free(buffer->y);
+    memset(buffer, 0, sizeof(ObstacleBuffer));
+}
+
+static inline void repulsion_one(const RepulsionParameters *p, float xo, float yo, float *fx, float *fy) {
+    float dx = p->pos_x - xo, dy = p->pos_y - yo;
+    float distance = sqrtf(dx * dx + dy * dy);
+    float rho = distance < REPULSION_MIN_RHO ? REPULSION_MIN_RHO : distance;
+    if (rho >= p->rho0) return;
+
+    float magnitude = p->eta * (1 / rho - 1 / p->rho0);
+    // Same direction as atan2, which gives theta = 0 when the drone is on the obstacle
+    float cos_theta = distance > 0 ? dx / distance : 1;
+    float sin_theta = distance > 0 ? dy / distance : 0;
+    float x = magnitude * cos_theta * p->speed_x;
+    float y = magnitude * sin_theta * p->speed_y;
+    *fx += x > p->max_force ? p->max_force : (x < -p->max_force ? -p->max_force : x);
+    *fy += y > p->max_force ? p->max_force : (y < -p->max_force ? -p->max_force : y);
+}
+
+static void repulsion_scalar(const RepulsionParameters *p, const float *x, const float *y, int n, float *fx, float *fy) {
+    float sum_x = 0, sum_y = 0;
+    for (int i = 0; i < n; i++) {
+        repulsion_one(p, x[i], y[i], &sum_x, &sum_y);
+    }
+    *fx = sum_x;
+    *fy = sum_y;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void repulsion_sse(const RepulsionParameters *p, const float *x, const float *y, int n, float *fx, float *fy) {
+    const __m128 px = _mm_set1_ps(p->pos_x), py = _mm_set1_ps(p->pos_y);
+    const __m128 vx = _mm_set1_ps(p->speed_x), vy = _mm_set1_ps(p->speed_y);
+    const __m128 rho0 = _mm_set1_ps(p->rho0), eta = _mm_set1_ps(p->eta), inv_rho0 = _mm_set1_ps(1 / p->rho0);
+    const __m128 max = _mm_set1_ps(p->max_force), min = _mm_set1_ps(-p->max_force);
+    const __m128 min_rho = _mm_set1_ps(REPULSION_MIN_RHO), max_inv_rho = _mm_set1_ps(1 / REPULSION_MIN_RHO);
+    const __m128 one = _mm_set1_ps(1), zero = _mm_setzero_ps();
+    __m128 sum_x = zero, sum_y = zero;
+
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 dx = _mm_sub_ps(px, _mm_loadu_ps(x + i));
+        __m128 dy = _mm_sub_ps(py, _mm_loadu_ps(y + i));
+        __m128 distance = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        __m128 rho = _mm_max_ps(distance, min_rho);
+        __m128 inside = _mm_cmplt_ps(rho, rho0);
+        __m128 on_top = _mm_cmpeq_ps(distance, zero);
+
+        // One division per obstacle: 1 / rho is 1 / distance capped at 1 / REPULSION_MIN_RHO
+        __m128 inv_distance = _mm_div_ps(one, distance);
+        __m128 magnitude = _mm_mul_ps(eta, _mm_sub_ps(_mm_min_ps(inv_distance, max_inv_rho), inv_rho0));
+        __m128 cos_theta = _mm_or_ps(_mm_and_ps(on_top, one), _mm_andnot_ps(on_top, _mm_mul_ps(dx, inv_distance)));
+        __m128 sin_theta = _mm_andnot_ps(on_top, _mm_mul_ps(dy, inv_distance));
+
+        __m128 force_x = _mm_min_ps(max, _mm_max_ps(min, _mm_mul_ps(_mm_mul_ps(magnitude, cos_theta), vx)));
+        __m128 force_y = _mm_min_ps(max, _mm_max_ps(min, _mm_mul_ps(_mm_mul_ps(magnitude, sin_theta), vy)));
+        sum_x = _mm_add_ps(sum_x, _mm_and_ps(inside, force_x));
+        sum_y = _mm_add_ps(sum_y, _mm_and_ps(inside, force_y));
+    }
+
+    float lanes_x[4], lanes_y[4];
+    _mm_storeu_ps(lanes_x, sum_x);
+    _mm_storeu_ps(lanes_y, sum_y);
+    float total_x = lanes_x[0] + lanes_x[1] + lanes_x[2] + lanes_x[3];
+    float total_y = lanes_y[0] + lanes_y[1] + lanes_y[2] + lanes_y[3];
+    for (; i < n; i++) {
+        repulsion_one(p, x[i], y[i], &total_x, &total_y);
+    }
+    *fx = total_x;
+    *fy = total_y;
+}
+
+__attribute__((target("avx2")))
+static void repulsion_avx2(const RepulsionParameters *p, const float *x, const float *y, int n, float *fx, float *fy) {
+    const __m256 px = _mm256_set1_ps(p->pos_x), py = _mm256_set1_ps(p->pos_y);
+    const __m256 vx = _mm256_set1_ps(p->speed_x), vy = _mm256_set1_ps(p->speed_y);
+    const __m256 rho0 = _mm256_set1_ps(p->rho0), eta = _mm256_set1_ps(p->eta), inv_rho0 = _mm256_set1_ps(1 / p->rho0);
+    const __m256 max = _mm256_set1_ps(p->max_force), min = _mm256_set1_ps(-p->max_force);
+    const __m256 min_rho = _mm256_set1_ps(REPULSION_MIN_RHO), max_inv_rho = _mm256_set1_ps(1 / REPULSION_MIN_RHO);
+    const __m256 one = _mm256_set1_ps(1), zero = _mm256_setzero_ps();
+    __m256 sum_x = zero, sum_y = zero;
+
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 dx = _mm256_sub_ps(px, _mm256_loadu_ps(x + i));
+        __m256 dy = _mm256_sub_ps(py, _mm256_loadu_ps(y + i));
+        __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        __m256 rho = _mm256_max_ps(distance, min_rho);
+        __m256 inside = _mm256_cmp_ps(rho, rho0, _CMP_LT_OQ);
+        __m256 on_top = _mm256_cmp_ps(distance, zero, _CMP_EQ_OQ);
+
+        // One division per obstacle: 1 / rho is 1 / distance capped at 1 / REPULSION_MIN_RHO
+        __m256 inv_distance = _mm256_div_ps(one, distance);
+        __m256 magnitude = _mm256_mul_ps(eta, _mm256_sub_ps(_mm256_min_ps(inv_distance, max_inv_rho), inv_rho0));
+        __m256 cos_theta = _mm256_blendv_ps(_mm256_mul_ps(dx, inv_distance), one, on_top);
+        __m256 sin_theta = _mm256_blendv_ps(_mm256_mul_ps(dy, inv_distance), zero, on_top);
+
+        __m256 force_x = _mm256_min_ps(max, _mm256_max_ps(min, _mm256_mul_ps(_mm256_mul_ps(magnitude, cos_theta), vx)));
+        __m256 force_y = _mm256_min_ps(max, _mm256_max_ps(min, _mm256_mul_ps(_mm256_mul_ps(magnitude, sin_theta), vy)));
+        sum_x = _mm256_add_ps(sum_x, _mm256_and_ps(inside, force_x));
+        sum_y = _mm256_add_ps(sum_y, _mm256_and_ps(inside, force_y));
+    }
+
+    float lanes_x[8], lanes_y[8];
+    _mm256_storeu_ps(lanes_x, sum_x);
+    _mm256_storeu_ps(lanes_y, sum_y);
+    float total_x = 0, total_y = 0;
+    for (int lane = 0; lane < 8; lane++) {
+        total_x += lanes_x[lane];
+        total_y += lanes_y[lane];
+    }
+    for (; i < n; i++) {
+        repulsion_one(p, x[i], y[i], &total_x, &total_y);
+    }
+    *fx = total_x;
+    *fy = total_y;
+}
+#endif
+
+// Pick a kernel by name ("avx2", "sse", "scalar"), or the fastest one supported by the CPU when NULL
+static RepulsionKernel repulsion_select(const char *name) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    int avx2 = __builtin_cpu_supports("avx2"), sse = __builtin_cpu_supports("sse2");
+    if (name == NULL) return avx2 ? repulsion_avx2 : (sse ? repulsion_sse : repulsion_scalar);
+    if (strcmp(name, "avx2") == 0 && avx2) return repulsion_avx2;
+    if (strcmp(name, "sse") == 0 && sse) return repulsion_sse;
+#endif
+    if (name == NULL || strcmp(name, "scalar") == 0) return repulsion_scalar;
+    return NULL;
+}
+
+#endif
@@ -1,23 +1,223 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <fcntl.h>
-#include <sys/select.h>
 #include <string.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <sys/timerfd.h>
 #include <semaphore.h>
 #include <errno.h>
-#include <pthread.h>
 #include "helper.h"
+#include "latency.h"
+#include "frame.h"
+#include "event_loop.h"
+#include "fanout.h"
+#include "world.h"
+#include "prng.h"
+#include "ready.h"
+#include "heartbeat.h"
 
 FILE *debug, *errors;       // File descriptors for the two log files
-pid_t wd_pid, map_pid, obs_pid, targ_pid;
-Drone *drone;
-time_t start;
+pid_t map_pid;
+Swarm *swarm;
+World *world;
+Heartbeat *heartbeat;
 int n_obs;
 int n_targ;
+int n_drones;
+LatencyHistogram key_forward_latency = LATENCY_HISTOGRAM("key pressed -> forwarded by the server");
+volatile sig_atomic_t dump_requested = 0;
+
+// Periodic generation of one set, the requests are queued in the pipe of its generator
+typedef struct {
+    const char *name;
+    int timer_fd;                           // Expires when the next set is due
+    int write_fd;                           // Pipe to the generator
+    uint64_t period, jitter;                // Nanoseconds
+} GenerationSchedule;
+
+// Pipes and receive buffers shared by the handlers of the server loop
+typedef struct {
+    EventLoop loop;
+    int drone_write_map_fd, drone_write_key_fd, drone_write_obstacles_fd, drone_write_targets_fd;
+    int map_write_fd, obstacle_write_map_fd, target_write_map_fd;
+    FrameHeader obstacles, targets;
+    GenerationSchedule schedules[WORLD_SETS];   // Indexed by WORLD_OBSTACLES and WORLD_TARGETS
+    Prng jitter;                            // Only moves the deadlines, the sets are drawn by the generators
+} ServerContext;
+
+// Stop watching a source once its writer is gone and nothing is left to read
+int source_closed(ServerContext *context, int fd, uint32_t events, const char *name) {
+    if (!(events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) || event_pending(fd) > 0) return 0;
+    char message[128];
+    snprintf(message, sizeof(message), "The %s closed its pipe", name);
+    LOG_TO_FILE(errors, message);
+    event_loop_remove(&context->loop, fd);
+    return 1;
+}
+
+// Send a frame to the subscribers: the header is rewritten, the records go from pipe to pipe
+int forward_frame(int fd, const FrameHeader *header, const int *out_fds, int n_out) {
+    for (int i = 0; i < n_out; i++) {
+        if (write_full(out_fds[i], header, sizeof(FrameHeader)) == -1) return -1;
+    }
+    size_t size = frame_payload_size(header);
+    return size > 0 ? pipe_fanout(fd, out_fds, n_out, size) : 0;
+}
+
+// Nanoseconds from an environment variable in seconds, the default when it is missing or negative
+uint64_t seconds_from_env(const char *name, double seconds) {
+    const char *value = getenv(name);
+    if (value != NULL && atof(value) >= 0) seconds = atof(value);
+    return (uint64_t)(seconds * 1e9);
+}
+
+// Arm the timer of a schedule one period from now, moved by a random offset within the jitter
+int schedule_next(ServerContext *context, GenerationSchedule *schedule) {
+    uint64_t delay = schedule->period;
+    if (schedule->jitter > 0) {
+        uint64_t offset = prng_next(&context->jitter) % (2 * schedule->jitter + 1);
+        delay = delay + offset > schedule->jitter ? delay + offset - schedule->jitter : 0;
+    }
+    struct itimerspec spec = {0};
+    if (delay == 0) delay = 1;              // A zero expiration would disarm the timer
+    spec.it_value.tv_sec = delay / 1000000000ULL;
+    spec.it_value.tv_nsec = delay % 1000000000ULL;
+    return timerfd_settime(schedule->timer_fd, 0, &spec, NULL);
+}
+
+// Ask the generator of a set for a new one and start its period again
+void request_generation(ServerContext *context, int set, const char *reason) {
+    GenerationSchedule *schedule = &context->schedules[set];
+    char message[128];
+    snprintf(message, sizeof(message), "Requesting new %s: %s", schedule->name, reason);
+    LOG_TO_FILE(debug, message);
+    if (write_full(schedule->write_fd, GENERATION_REQUEST, strlen(GENERATION_REQUEST)) == -1) {
+        LOG_TO_FILE(errors, "Error sending the generation request");
+    }
+    if (schedule_next(context, schedule) == -1) {
+        LOG_TO_FILE(errors, "Error arming the generation timer");
+    }
+}
+
+// The period of a set has elapsed
+void handle_generation_timer(int fd, uint32_t events, void *data) {
+    ServerContext *context = data;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+    for (int set = 0; set < WORLD_SETS; set++) {
+        if (context->schedules[set].timer_fd == fd) request_generation(context, set, "period elapsed");
+    }
+}
+
+// The drone has sent a control message
+void handle_drone_events(int fd, uint32_t events, void *data) {
+    ServerContext *context = data;
+    FrameHeader header;
+    while (event_pending(fd) > 0) {
+        if (frame_read_header(fd, &header) <= 0) {
+            LOG_TO_FILE(errors, "Invalid message from the drone");
+            break;
+        }
+        // A message about a set that was already replaced is late and ignored
+        if (header.type == 'c' && header.generation == context->targets.generation) {
+            request_generation(context, WORLD_TARGETS, "every target was reached");
+        }
+    }
+    source_closed(context, fd, events, "DRONE");
+}
+
+// The map process has sent the map size
+void handle_map_size(int fd, uint32_t events, void *data) {
+    ServerContext *context = data;
+    int subscribers[] = {context->drone_write_map_fd, context->obstacle_write_map_fd, context->target_write_map_fd};
+    int pending;
+    while ((pending = event_pending(fd)) > 0) {
+        if (pipe_fanout(fd, subscribers, 3, pending) == -1) {
+            LOG_TO_FILE(errors, "Error forwarding the map size");
+            break;
+        }
+        // The generators draw a new set for the new size, so their periods start again
+        for (int set = 0; set < WORLD_SETS; set++) schedule_next(context, &context->schedules[set]);
+    }
+    source_closed(context, fd, events, "MAP");
+}
+
+// The input process has sent the keys that were pressed
+void handle_keys(int fd, uint32_t events, void *data) {
+    ServerContext *context = data;
+    KeyMessage messages[64];
+    // The messages are smaller than PIPE_BUF, so the pipe only holds whole messages
+    while (event_pending(fd) > 0) {
+        ssize_t bytes_read = read(fd, messages, sizeof(messages));
+        if (bytes_read <= 0) break;
+        // Only the keys of an existing drone, or of the whole swarm, are forwarded
+        size_t count = 0;
+        for (size_t i = 0; i < bytes_read / sizeof(KeyMessage); i++) {
+            if (messages[i].drone != DRONE_ALL && (messages[i].drone < 0 || messages[i].drone >= n_drones)) {
+                LOG_EVENT(errors, "Dropped a key for the drone %d, there are %d drones", messages[i].drone, n_drones);
+                continue;
+            }
+            messages[count++] = messages[i];
+        }
+        if (count == 0) continue;
+        if (write_full(context->drone_write_key_fd, messages, count * sizeof(KeyMessage)) == -1) {
+            LOG_TO_FILE(errors, "Error forwarding the keys to the drone");
+            continue;
+        }
+        uint64_t now = monotonic_ns();
+        for (size_t i = 0; i < count; i++) {
+            latency_record(&key_forward_latency, now - messages[i].origin);
+        }
+    }
+    source_closed(context, fd, events, "INPUT");
+}
+
+// The obstacle process has sent the position of the obstacles generated
+void handle_obstacles(int fd, uint32_t events, void *data) {
+    ServerContext *context = data;
+    int subscribers[] = {context->drone_write_obstacles_fd, context->map_write_fd};
+    // The generator writes whole frames, so a frame that has started arriving is completed shortly.
+    // A streamed set is forwarded one chunk at a time, the server never holds more than a pipe buffer of it
+    while (event_pending(fd) > 0) {
+        if (frame_read_header(fd, &context->obstacles) <= 0) {
+            LOG_TO_FILE(errors, "Invalid frame of obstacles");
+            break;
+        }
+        if (frame_is_last(&context->obstacles)) {
+            LOG_EVENT(debug, "Received generation %u with %u obstacles", context->obstacles.generation, context->obstacles.total);
+        }
+        if (forward_frame(fd, &context->obstacles, subscribers, 2) == -1) {
+            LOG_TO_FILE(errors, "Error forwarding the obstacles");
+            break;
+        }
+    }
+    source_closed(context, fd, events, "OBSTACLE");
+}
+
+// The target process has sent the position of the targets generated
+void handle_targets(int fd, uint32_t events, void *data) {
+    ServerContext *context = data;
+    // The map draws the streamed targets, it needs their frames as well
+    int subscribers[] = {context->drone_write_targets_fd, context->map_write_fd};
+    while (event_pending(fd) > 0) {
+        if (frame_read_header(fd, &context->targets) <= 0) {
+            LOG_TO_FILE(errors, "Invalid frame of targets");
+            break;
+        }
+        if (frame_is_last(&context->targets)) {
+            LOG_EVENT(debug, "Received generation %u with %u targets", context->targets.generation, context->targets.total);
+        }
+        if (forward_frame(fd, &context->targets, subscribers, 2) == -1) {
+            LOG_TO_FILE(errors, "Error forwarding the targets");
+            break;
+        }
+    }
+    source_closed(context, fd, events, "TARGET");
+}
 
 void server(int drone_write_map_fd, 
             int drone_write_key_fd, 
@@ -29,88 +229,79 @@ void server(int drone_write_map_fd,
             int obstacle_write_map_fd, 
             int obstacle_read_position_fd, 
             int target_write_map_fd, 
-            int target_read_position_fd) {
-
-    char buffer[2048];
-    fd_set read_fds;
-    struct timeval timeout;
-
-    int max_fd = -1;
-    if (map_read_fd > max_fd) {
-        max_fd = map_read_fd;
-    }
-    if(input_read_fd > max_fd) {
-        max_fd = input_read_fd;
-    }
-    if (obstacle_read_position_fd > max_fd) {
-        max_fd = obstacle_read_position_fd;
-    }
-    if(target_read_position_fd > max_fd) {
-        max_fd = target_read_position_fd;
+            int target_read_position_fd,
+            int drone_read_events_fd) {
+
+    ServerContext context = {0};
+    context.drone_write_map_fd = drone_write_map_fd;
+    context.drone_write_key_fd = drone_write_key_fd;
+    context.drone_write_obstacles_fd = drone_write_obstacles_fd;
+    context.drone_write_targets_fd = drone_write_targets_fd;
+    context.map_write_fd = map_write_fd;
+    context.obstacle_write_map_fd = obstacle_write_map_fd;
+    context.target_write_map_fd = target_write_map_fd;
+
+    // Periods of the generations, the first sets are drawn as soon as the map size is known
+    GenerationSchedule *obstacles = &context.schedules[WORLD_OBSTACLES], *targets = &context.schedules[WORLD_TARGETS];
+    uint64_t jitter = seconds_from_env(GENERATION_JITTER_VARIABLE, 0);
+    obstacles->name = "obstacles";
+    obstacles->write_fd = obstacle_write_map_fd;
+    obstacles->period = seconds_from_env(OBSTACLES_PERIOD_VARIABLE, GENERATION_PERIOD);
+    targets->name = "targets";
+    targets->write_fd = target_write_map_fd;
+    targets->period = seconds_from_env(TARGETS_PERIOD_VARIABLE, GENERATION_PERIOD);
+    prng_seed(&context.jitter, monotonic_ns() ^ getpid());
+    for (int set = 0; set < WORLD_SETS; set++) {
+        GenerationSchedule *schedule = &context.schedules[set];
+        schedule->jitter = jitter < schedule->period ? jitter : schedule->period;
+        schedule->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (schedule->timer_fd == -1 || schedule_next(&context, schedule) == -1) {
+            perror("Error creating the generation timers");
+            LOG_TO_FILE(errors, "Error creating the generation timers");
+            // Close the files
+            fclose(debug);
+            fclose(errors);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    while (1) {
-        FD_ZERO(&read_fds);
-        FD_SET(input_read_fd, &read_fds);
-        FD_SET(map_read_fd, &read_fds);
-        FD_SET(obstacle_read_position_fd, &read_fds);
-        FD_SET(target_read_position_fd, &read_fds);
+    // Every source is registered once, the loop only wakes up for the ones that changed
+    if (event_loop_init(&context.loop) == -1 ||
+        event_loop_add(&context.loop, map_read_fd, handle_map_size, &context) == -1 ||
+        event_loop_add(&context.loop, input_read_fd, handle_keys, &context) == -1 ||
+        event_loop_add(&context.loop, obstacle_read_position_fd, handle_obstacles, &context) == -1 ||
+        event_loop_add(&context.loop, target_read_position_fd, handle_targets, &context) == -1 ||
+        event_loop_add(&context.loop, drone_read_events_fd, handle_drone_events, &context) == -1 ||
+        event_loop_add(&context.loop, obstacles->timer_fd, handle_generation_timer, &context) == -1 ||
+        event_loop_add(&context.loop, targets->timer_fd, handle_generation_timer, &context) == -1) {
+        perror("Error registering the server's pipes");
+        LOG_TO_FILE(errors, "Error registering the pipes in the event loop");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
 
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        int activity;
-        do {
-            activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
-        } while(activity == -1 && errno == EINTR);
+    // The timers never close, so the loop ends when only they are left
+    while (context.loop.count > WORLD_SETS) {
+        // The wait below never lasts more than HEARTBEAT_INTERVAL_MS
+        heartbeat_beat(heartbeat, PROC_SERVER);
+        if (dump_requested) {
+            dump_requested = 0;
+            char message[256];
+            latency_format(&key_forward_latency, message, sizeof(message));
+            LOG_TO_FILE(debug, message);
+        }
 
-        if (activity < 0) {
-            perror("Error in the server's select");
-            LOG_TO_FILE(errors, "Error in select which pipe reads");
+        if (event_loop_wait(&context.loop, HEARTBEAT_INTERVAL_MS) == -1) {
+            perror("Error in the server's epoll_wait");
+            LOG_TO_FILE(errors, "Error in epoll_wait which pipe reads");
             break;
-        } else if (activity > 0) {
-            memset(buffer, '\0', sizeof(buffer));
-            // Check if the map process has sent him the map size
-            if (FD_ISSET(map_read_fd, &read_fds)) {
-                ssize_t bytes_read = read(map_read_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0'; // End the string
-                    write(drone_write_map_fd, buffer, strlen(buffer));
-                    write(obstacle_write_map_fd, buffer, strlen(buffer));
-                    write(target_write_map_fd, buffer, strlen(buffer));
-                    time(&start);
-                }
-            }
-            // Check if the input process has sent him a key that was pressed
-            if (FD_ISSET(input_read_fd, &read_fds)) {
-                ssize_t bytes_read = read(input_read_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0';
-                    write(drone_write_key_fd, buffer, strlen(buffer));
-                }
-            }
-            // Check if the obstacle process has sent him the position of the obstacles generated
-            if (FD_ISSET(obstacle_read_position_fd, &read_fds)) {
-                ssize_t bytes_read = read(obstacle_read_position_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0';
-                    LOG_TO_FILE(errors, buffer);
-                    write(drone_write_obstacles_fd, buffer, strlen(buffer));
-                    write(map_write_fd, buffer, strlen(buffer));
-                    printf("[SERVER] : %d", map_write_fd);
-                }
-            }
-            // Check if the target process has sent him the position of the targets generated
-            if (FD_ISSET(target_read_position_fd, &read_fds)) {
-                ssize_t bytes_read = read(target_read_position_fd, buffer, sizeof(buffer) - 1);
-                if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0';
-                    LOG_TO_FILE(errors, buffer);
-                    write(drone_write_targets_fd, buffer, strlen(buffer));
-                    //write(map_write_fd, buffer, strlen(buffer));
-                }
-            }
         }
     }    
+    event_loop_free(&context.loop);
+    close(obstacles->timer_fd);
+    close(targets->timer_fd);
     // Close file descriptor
     close(drone_write_key_fd);
     close(drone_write_map_fd);
@@ -123,13 +314,12 @@ void server(int drone_write_map_fd,
     close(obstacle_read_position_fd);
     close(target_write_map_fd);
     close(target_read_position_fd);
+    close(drone_read_events_fd);
 }
 
 void signal_handler(int sig, siginfo_t* info, void *context) {
-    if (sig == SIGUSR1) {
-        wd_pid = info->si_pid;
-        LOG_TO_FILE(debug, "Signal SIGUSR1 received from WATCHDOG");
-        kill(wd_pid, SIGUSR1);
+    if (sig == LATENCY_DUMP_SIGNAL) {
+        dump_requested = 1;
     }
     if (sig == SIGUSR2) {
         LOG_TO_FILE(debug, "Shutting down by the WATCHDOG");
@@ -145,9 +335,12 @@ void signal_handler(int sig, siginfo_t* info, void *context) {
         }
 
         // Close the semaphore and unlink it
-        sem_close(drone->sem);
+        sem_close(swarm->sem);
         sem_unlink("drone_sem");
 
+        // The generators and the readers keep their mapping, the name is only removed
+        shm_unlink(WORLD_SHARED_MEMORY);
+
         if (kill(map_pid, SIGUSR2) == -1) {
             perror("Error sending SIGTERM signal to the MAP");
             LOG_TO_FILE(errors, "Error sending SIGTERM signal to the MAP");
@@ -161,6 +354,7 @@ void signal_handler(int sig, siginfo_t* info, void *context) {
     }
 }
 
+// Create the segment with the states of the drones, sized for n_drones
 int create_shared_memory() {
     int mem_fd = shm_open(DRONE_SHARED_MEMORY, O_CREAT | O_RDWR, 0666);
     if (mem_fd == -1) {
@@ -173,7 +367,7 @@ int create_shared_memory() {
     }
     
     // Set the size of the shared memory
-    if(ftruncate(mem_fd, sizeof(Drone)) == -1){
+    if(ftruncate(mem_fd, swarm_size(n_drones)) == -1){
         perror("Error setting the size of the shared memory");
         LOG_TO_FILE(errors, "Error setting the size of the shared memory");
         // Close the files
@@ -182,9 +376,9 @@ int create_shared_memory() {
         exit(EXIT_FAILURE);
     }
 
-    // Map the shared memory into a drone objects
-    drone = (Drone *)mmap(0, sizeof(Drone), PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
-    if (drone == MAP_FAILED) {
+    // Map the shared memory into the swarm
+    swarm = (Swarm *)mmap(0, swarm_size(n_drones), PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (swarm == MAP_FAILED) {
         perror("Error mapping the shared memory");
         LOG_TO_FILE(errors, "Error mapping the shared memory");
         // Close the files
@@ -192,74 +386,44 @@ int create_shared_memory() {
         fclose(errors);   
         exit(EXIT_FAILURE);
     }
+    swarm->count = n_drones;
     LOG_TO_FILE(debug, "Created and opened the shared memory");
     return mem_fd;
 }
 
-void *send_signal_generation_thread() {
-    time_t finish;
-    double diff; 
-    pid_t pid_t_o[] = {targ_pid, obs_pid};
-
-    while(1) {
-        time(&start);
-        do {
-            time(&finish);
-            diff = difftime(finish, start);
-        } while (diff < 15);
-
-        for(int i = 0; i < 2; i++) {
-            if(pid_t_o[i] < 0) continue;
-            
-            if (kill(pid_t_o[i], SIGTERM) == -1) {
-                perror("Error sending signal kill");
-                switch (i) {
-                    case 0:
-                        LOG_TO_FILE(errors, "Error sending signal kill to the TARGET");
-                        break;
-                    case 1:
-                        LOG_TO_FILE(errors, "Error sending signal kill to the OBSTACLE");
-                        break;
-                }
-            }
-        }
+// Create the segment with the obstacles and the targets, sized for the configured numbers
+int create_world_memory() {
+    shm_unlink(WORLD_SHARED_MEMORY);
+    int world_fd = shm_open(WORLD_SHARED_MEMORY, O_CREAT | O_RDWR, 0666);
+    if (world_fd == -1) {
+        perror("Error opening the world shared memory");
+        LOG_TO_FILE(errors, "Error opening the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
     }
-}
-
-int get_pid_by_command(const char *process_name) {
-    char command[256];
-    char buffer[1024];
-    FILE *pipe;
-    int pid = -1;
-
-    /*Per sistei più lenti bisogna aumentare la sleep altrimenti 
-    target e obstacle non vengono avviati in tempo*/
-
-    sleep(2);
-
-    // Costruisci il comando ps aux | grep <process_name>
-    snprintf(command, sizeof(command), "ps aux | grep '%s' | grep -v 'grep'", process_name);
-
-    // Esegui il comando usando popen
-    pipe = popen(command, "r");
-    if (!pipe) {
-        perror("popen");
-        return -1;
+    size_t size = world_size(n_obs, n_targ);
+    if (ftruncate(world_fd, size) == -1) {
+        perror("Error setting the size of the world shared memory");
+        LOG_TO_FILE(errors, "Error setting the size of the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
     }
-
-    // Leggi l'output del comando
-    while (fgets(buffer, sizeof(buffer), pipe) != NULL) {
-        // Analizza l'output per estrarre il PID
-        char user[32], cmd_part[128];
-        if (sscanf(buffer, "%s %d %*f %*f %*f %*f %*s %*s %*s %*s %[^\n]", user, &pid, cmd_part) == 3) {
-            if (strstr(cmd_part, process_name) != NULL) {
-                break; // Trovato il PID, esci dal loop
-            }
-        }
+    world = (World *)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, world_fd, 0);
+    if (world == MAP_FAILED) {
+        perror("Error mapping the world shared memory");
+        LOG_TO_FILE(errors, "Error mapping the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
     }
-
-    pclose(pipe);
-    return pid; // Ritorna il PID trovato, o -1 se non trovato
+    world_init(world, n_obs, n_targ);
+    LOG_TO_FILE(debug, "Created and opened the world shared memory");
+    return world_fd;
 }
 
 int main(int argc, char *argv[]) {
@@ -274,8 +438,10 @@ int main(int argc, char *argv[]) {
         perror("Error opening the errors file");
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
 
-    if (argc < 15) {
+    if (argc < 16) {
         LOG_TO_FILE(errors, "Invalid number of parameters");
         // Close the files
         fclose(debug);
@@ -294,7 +460,8 @@ int main(int argc, char *argv[]) {
         target_write_map_fd = atoi(argv[6]), 
         target_read_position_fd = atoi(argv[7]),
         drone_write_obstacles_fd = atoi(argv[8]), 
-        drone_write_targets_fd = atoi(argv[9]); 
+        drone_write_targets_fd = atoi(argv[9]), 
+        drone_read_events_fd = atoi(argv[15]); 
 
     int pipe_fd[2];
     int pipe2_fd[2];
@@ -325,12 +492,21 @@ int main(int argc, char *argv[]) {
     printf("[SERVER] : %d\n", pipe2_fd[0]);
 
     /* CREATE THE SHARED MEMORY */
+    // Number of drones given by the main, one when appsettings.json does not set it
+    const char *drones_value = getenv(DRONES_VARIABLE);
+    n_drones = drones_value != NULL ? atoi(drones_value) : N_DRONES;
+    if (n_drones < 1 || n_drones > MAX_DRONES) {
+        char message[100];
+        snprintf(message, sizeof(message), "Invalid number of drones %d, using %d", n_drones, N_DRONES);
+        LOG_TO_FILE(errors, message);
+        n_drones = N_DRONES;
+    }
     int mem_fd = create_shared_memory();
 
     /* CREATE THE SEMAPHORE */
     sem_unlink("drone_sem");
-    drone->sem = sem_open("drone_sem", O_CREAT | O_RDWR, 0666, 1);
-    if (drone->sem == SEM_FAILED) {
+    swarm->sem = sem_open("drone_sem", O_CREAT | O_RDWR, 0666, 1);
+    if (swarm->sem == SEM_FAILED) {
         perror("Error creating the semaphore for the drone");
         LOG_TO_FILE(errors, "Error creating the semaphore for the drone");
         // Close the files
@@ -341,12 +517,21 @@ int main(int argc, char *argv[]) {
 
     /* SET THE INITIAL CONFIGURATION */   
     // Lock
-    sem_wait(drone->sem);
-    // Setting the initial position
-    LOG_TO_FILE(debug, "Initialized initial position to the drone");
-    sscanf(argv[10], "%f,%f", &drone->pos_x, &drone->pos_y);
-    sscanf(argv[11], "%f,%f", &drone->vel_x, &drone->vel_y);
-    sscanf(argv[12], "%f,%f", &drone->force_x, &drone->force_y);
+    sem_wait(swarm->sem);
+    swarm_write_begin(swarm);
+    // Setting the initial position, the drones start in rows of DRONES_PER_ROW from the configured one
+    Drone initial;
+    sscanf(argv[10], "%f,%f", &initial.pos_x, &initial.pos_y);
+    sscanf(argv[11], "%f,%f", &initial.vel_x, &initial.vel_y);
+    sscanf(argv[12], "%f,%f", &initial.force_x, &initial.force_y);
+    for (int i = 0; i < n_drones; i++) {
+        swarm->drones[i] = initial;
+        swarm->drones[i].pos_x += DRONE_SPACING * (i % DRONES_PER_ROW);
+        swarm->drones[i].pos_y += DRONE_SPACING * (i / DRONES_PER_ROW);
+    }
+    char drones_message[64];
+    snprintf(drones_message, sizeof(drones_message), "Initialized initial position to %d drones", n_drones);
+    LOG_TO_FILE(debug, drones_message);
 
     n_obs = atoi(argv[13]);
     n_targ = atoi(argv[14]);
@@ -358,11 +543,33 @@ int main(int argc, char *argv[]) {
     snprintf(n_targ_str, sizeof(n_targ_str), "%d", n_targ);
 
     // Unlock
-    sem_post(drone->sem);
+    swarm_write_end(swarm);
+    sem_post(swarm->sem);
+
+    /* CREATE THE WORLD SHARED MEMORY */
+    int world_fd = create_world_memory();
+
+    /* OPEN THE HEARTBEAT */
+    heartbeat = heartbeat_open();
+    if (heartbeat == NULL) {
+        perror("Error opening the heartbeat shared memory");
+        LOG_TO_FILE(errors, "Error opening the heartbeat shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);
+        exit(EXIT_FAILURE);
+    }
+    heartbeat_beat(heartbeat, PROC_SERVER);
 
     /* LAUNCH THE MAP WINDOW */
-    // Fork to create the map window process
-    char *map_window_path[] = {"konsole", "-e", "./map_window", write_fd_str, map_read2_fd_str, n_obs_str, n_targ_str, NULL};
+    // Fork to create the map window process, in headless mode it is started directly without konsole
+    int headless = argc > 16 && strcmp(argv[16], HEADLESS_FLAG) == 0;
+    char *map_window_path[] = {"konsole", "-e", "./map_window", write_fd_str, map_read2_fd_str, n_obs_str, n_targ_str, NULL, NULL};
+    char **map_command = map_window_path;
+    if (headless) {
+        map_window_path[7] = HEADLESS_FLAG;
+        map_command = map_window_path + 2;
+    }
     map_pid = fork();
     if (map_pid ==-1){
         perror("Error forking the map file");
@@ -372,7 +579,7 @@ int main(int argc, char *argv[]) {
         fclose(errors);
         exit(EXIT_FAILURE);
     } else if (map_pid == 0){
-        execvp(map_window_path[0], map_window_path);
+        execvp(map_command[0], map_command);
         perror("Failed to execute to launch the map file");
         LOG_TO_FILE(errors, "Failed to execute to launch the map file");
         // Close the files
@@ -386,15 +593,6 @@ int main(int argc, char *argv[]) {
     sa.sa_flags = SA_SIGINFO;
     sa.sa_sigaction = signal_handler;
     sigemptyset(&sa.sa_mask);
-    // Set the signal handler for SIGUSR1
-    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
-        perror("Error in sigaction(SIGURS1)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS1)");
-        // Close the files
-        fclose(debug);
-        fclose(errors);
-        exit(EXIT_FAILURE);
-    }
     // Set the signal handler for SIGUSR2
     if(sigaction(SIGUSR2, &sa, NULL) == -1){
         perror("Error in sigaction(SIGURS2)");
@@ -405,22 +603,22 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    obs_pid = get_pid_by_command("./obstacle");
-    targ_pid = get_pid_by_command("./target");
-
-    usleep(50000);
-
-    // LAUNCH THE THREAD FOR PERIODIC SIGNAL
-    pthread_t server_thread;
-    if (pthread_create(&server_thread, NULL, send_signal_generation_thread, NULL) != 0) {
-        perror("Error creating the thread for updating the drone's information");
-        LOG_TO_FILE(errors, "Error creating the thread for updating the drone's information");
+    // Set the signal handler for the latency dump
+    if(sigaction(LATENCY_DUMP_SIGNAL, &sa, NULL) == -1){
+        perror("Error in sigaction(LATENCY_DUMP_SIGNAL)");
+        LOG_TO_FILE(errors, "Error in sigaction(LATENCY_DUMP_SIGNAL)");
         // Close the files
         fclose(debug);
-        fclose(errors);   
+        fclose(errors);
         exit(EXIT_FAILURE);
     }
 
+    /* REPORT TO THE LAUNCHER */
+    if (ready_notify(PROC_SERVER) == -1) {
+        perror("Error reporting to the launcher");
+        LOG_TO_FILE(errors, "Error reporting to the launcher");
+    }
+
     /* LAUNCH THE SERVER */
     server(drone_write_map_fd, 
             drone_write_key_fd, 
@@ -432,7 +630,8 @@ int main(int argc, char *argv[]) {
             obstacle_write_map_fd, 
             obstacle_read_position_fd, 
             target_write_map_fd, 
-            target_read_position_fd);
+            target_read_position_fd,
+            drone_read_events_fd);
 
     /* END PROGRAM */
     // Unlink the shared memory
@@ -454,10 +653,16 @@ int main(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
     // Unmap the shared memory region
-    munmap(drone, sizeof(Drone));
+    sem_t *sem = swarm->sem;
+    munmap(swarm, swarm_size(n_drones));
+
+    // Unlink and unmap the world
+    shm_unlink(WORLD_SHARED_MEMORY);
+    close(world_fd);
+    munmap(world, world->size);
 
     // Close the semaphore and unlink it
-    sem_close(drone->sem);
+    sem_close(sem);
     sem_unlink("drone_sem");
 
     // Close the files
@@ -1,48 +1,100 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <sys/shm.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <math.h>
 #include <sys/select.h>
 #include <errno.h>
 #include "helper.h"
+#include "frame.h"
+#include "world.h"
+#include "prng.h"
+#include "ready.h"
+#include "heartbeat.h"
 
 FILE *debug, *errors;
 Game game;
 Drone *drone;
-pid_t wd_pid;
 int N_TARGET;
 int target_write_position_fd = -1;
+World *world;
+Heartbeat *heartbeat;
+uint32_t generation = 0;
+uint64_t seed;                          // World seed, every generation is drawn from a seed derived from it
+Prng prng;
+int streaming;                          // The sets go through the pipes instead of the world shared memory
+
+/**
+ * Stream the set through the pipe in chunks of FRAME_CHUNK_OBJECTS, drawn one chunk at a time,
+ * so the set can be larger than the world shared memory and the generator holds a chunk only.
+ * The coordinates are drawn in the same order as in the shared memory: a seed gives the same set.
+ */
+void stream_targets(uint32_t count) {
+    static WireObject chunk[FRAME_CHUNK_OBJECTS];
+    uint32_t sequence = 0, offset = 0;
+    do {
+        uint32_t size = count - offset < FRAME_CHUNK_OBJECTS ? count - offset : FRAME_CHUNK_OBJECTS;
+        for (uint32_t i = 0; i < size; i++) {
+            chunk[i].pos_x = prng_below(&prng, game.max_x-2) + 1;
+            chunk[i].pos_y = prng_below(&prng, game.max_y-2) + 1;
+            chunk[i].point = 1;
+            chunk[i].type = 't';
+            chunk[i].reserved = 0;
+        }
+        if (frame_write_chunk(target_write_position_fd, 't', generation, sequence++, offset, count, chunk, size) == -1) {
+            LOG_TO_FILE(errors, "Error sending the targets to the server");
+            return;
+        }
+        offset += size;
+        // A large set can keep the pipe full for a while
+        heartbeat_beat(heartbeat, PROC_TARGET);
+    } while (offset < count);
+}
 
 void generate_targets(){
-    Object targets[N_TARGET];
-    char targetStr[1024] = "";
-    char temp[50];
-    char msg[100];
-    // create targets
-    for (int i = 0; i < N_TARGET; i++){
-        // generates random coordinates
-        targets[i].pos_x = rand() % (game.max_x-2) + 1; 
-        targets[i].pos_y = rand() % (game.max_y-2) + 1;
-        targets[i].point = 1;
-        targets[i].type = 't';
-        sprintf(temp, "%d,%d,%d,%c|", targets[i].pos_x, targets[i].pos_y, targets[i].point, targets[i].type);
-        strcat(targetStr, temp);
-    }
-    write(target_write_position_fd, targetStr, strlen(targetStr));
-    targetStr[0] = '\0';
+    // The coordinates are drawn in [1, max - 2]: there is no room inside a smaller map
+    if (game.max_x <= 2 || game.max_y <= 2) {
+        LOG_EVENT(errors, "Map of %d x %d too small for the targets", game.max_x, game.max_y);
+        return;
+    }
+    uint32_t wanted = N_TARGET > 0 ? (uint32_t)N_TARGET : 0;
+    uint64_t generation_seed = prng_generation_seed(seed, PRNG_STREAM_TARGETS, generation + 1);
+    prng_seed(&prng, generation_seed);
+    uint32_t count;
+    if (streaming) {
+        count = wanted;
+        generation++;
+        stream_targets(count);
+    } else {
+        // create targets straight in the world shared memory
+        int32_t *x = world_x(world, WORLD_TARGETS), *y = world_y(world, WORLD_TARGETS), *point = world_point(world, WORLD_TARGETS);
+        count = wanted < world->sets[WORLD_TARGETS].capacity ? wanted : world->sets[WORLD_TARGETS].capacity;
+        world_write_begin(world, WORLD_TARGETS);
+        for (uint32_t i = 0; i < count; i++){
+            // generates random coordinates
+            x[i] = prng_below(&prng, game.max_x-2) + 1; 
+            y[i] = prng_below(&prng, game.max_y-2) + 1;
+            point[i] = 1;
+        }
+        world_write_end(world, WORLD_TARGETS, ++generation, count);
+    }
+
+    // Enough to regenerate this set alone
+    LOG_EVENT(debug, "Generation %u of the targets: world seed %llu, generation seed %llu, map %d x %d",
+              generation, seed, generation_seed, game.max_x, game.max_y);
+    // Only the header goes through the server, the readers copy the set from the shared memory
+    if (!streaming && frame_notify(target_write_position_fd, 't', generation, count) == -1) {
+        LOG_TO_FILE(errors, "Error sending the targets to the server");
+    }
 }
 
 void signal_handler(int sig, siginfo_t* info, void *context) {
-    if (sig == SIGUSR1) {
-        wd_pid = info->si_pid;
-        LOG_TO_FILE(debug, "Signal SIGUSR1 received from WATCHDOG");
-        kill(wd_pid, SIGUSR1);
-    }
 
     if (sig == SIGUSR2) {
         LOG_TO_FILE(debug, "Shutting down by the WATCHDOG");
@@ -51,13 +103,6 @@ void signal_handler(int sig, siginfo_t* info, void *context) {
         fclose(debug);
         exit(EXIT_SUCCESS);
     }
-
-    if (sig == SIGTERM) {
-        if (target_write_position_fd > 0) {
-            LOG_TO_FILE(debug, "Generating new targets position");
-            generate_targets();
-        }
-    }
 }
 
 int open_shared_memory() {
@@ -82,6 +127,39 @@ int open_shared_memory() {
     return mem_fd;
 }
 
+int open_world_memory() {
+    int world_fd = shm_open(WORLD_SHARED_MEMORY, O_RDWR, 0666);
+    struct stat info;
+    if (world_fd == -1 || fstat(world_fd, &info) == -1) {
+        perror("Error opening the world shared memory");
+        LOG_TO_FILE(errors, "Error opening the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+    world = (World *)mmap(0, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, world_fd, 0);
+    if (world == MAP_FAILED || world->magic != WORLD_MAGIC) {
+        perror("Error mapping the world shared memory");
+        LOG_TO_FILE(errors, "Error mapping the world shared memory");
+        // Close the files
+        fclose(debug);
+        fclose(errors);   
+        exit(EXIT_FAILURE);
+    }
+    return world_fd;
+}
+
+// Request of the server: the map size "width, height" after a resize, or GENERATION_REQUEST
+void handle_request(const char *request) {
+    if (sscanf(request, "%d, %d", &game.max_x, &game.max_y) == 2) {
+        generate_targets();
+    } else if (strncmp(request, GENERATION_REQUEST, strlen(GENERATION_REQUEST) - 1) == 0 && game.max_x > 2 && game.max_y > 2) {
+        LOG_TO_FILE(debug, "Generating new targets position");
+        generate_targets();
+    }
+}
+
 int main(int argc, char* argv[]) {
     debug = fopen("debug.log", "a");
     if (debug == NULL) {
@@ -93,6 +171,8 @@ int main(int argc, char* argv[]) {
         perror("fopen");
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
     
     if (argc < 2) {
         LOG_TO_FILE(errors, "Invalid number of parameters");
@@ -110,6 +190,10 @@ int main(int argc, char* argv[]) {
 
     /* IMPORT CONFIGURATION PARAMETERS FROM THE MAIN */
     N_TARGET = atoi(argv[3]);
+    seed = argc > 4 ? strtoull(argv[4], NULL, 10) : 0;
+    // Transport of the sets chosen in appsettings.json, the world shared memory by default
+    const char *transport = getenv(WORLD_TRANSPORT_VARIABLE);
+    streaming = transport != NULL && strcmp(transport, WORLD_TRANSPORT_STREAM) == 0;
 
     /* SETTING THE SIGNALS */
     struct sigaction sa;
@@ -117,15 +201,6 @@ int main(int argc, char* argv[]) {
     sa.sa_sigaction = signal_handler;
     sigemptyset(&sa.sa_mask);
 
-    // Set the signal handler for SIGUSR1
-    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
-        perror("Error in sigaction(SIGURS1)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS1)");
-        // Close the files
-        fclose(debug);
-        fclose(errors);
-        exit(EXIT_FAILURE);
-    }
     // Set the signal handler for SIGUSR2
     if(sigaction(SIGUSR2, &sa, NULL) == -1){
         perror("Error in sigaction(SIGURS2)");
@@ -135,20 +210,31 @@ int main(int argc, char* argv[]) {
         fclose(errors);
         exit(EXIT_FAILURE);
     }
-    // Set the signal handler for SIGUSR2
-    if(sigaction(SIGTERM, &sa, NULL) == -1){
-        perror("Error in sigaction(SIGTERM)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGTERM)");
+
+    /* OPEN SHARED MEMORY */
+    int mem_fd = open_shared_memory();
+    int world_fd = open_world_memory();
+
+    /* OPEN THE HEARTBEAT */
+    heartbeat = heartbeat_open();
+    if (heartbeat == NULL) {
+        perror("Error opening the heartbeat shared memory");
+        LOG_TO_FILE(errors, "Error opening the heartbeat shared memory");
         // Close the files
         fclose(debug);
         fclose(errors);
         exit(EXIT_FAILURE);
     }
+    heartbeat_beat(heartbeat, PROC_TARGET);
 
-    /* OPEN SHARED MEMORY */
-    int mem_fd = open_shared_memory();
+    /* REPORT TO THE LAUNCHER */
+    if (ready_notify(PROC_TARGET) == -1) {
+        perror("Error reporting to the launcher");
+        LOG_TO_FILE(errors, "Error reporting to the launcher");
+    }
 
     char buffer[256];
+    size_t length = 0;                      // Bytes of an incomplete request at the start of the buffer
     fd_set read_fds;
     struct timeval timeout;
 
@@ -161,8 +247,10 @@ int main(int argc, char* argv[]) {
         FD_ZERO(&read_fds);
         FD_SET(target_read_map_fd, &read_fds);
 
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
+        // The loop beats at every iteration, so it never waits longer than HEARTBEAT_INTERVAL_MS
+        heartbeat_beat(heartbeat, PROC_TARGET);
+        timeout.tv_sec = HEARTBEAT_INTERVAL_MS / 1000;
+        timeout.tv_usec = HEARTBEAT_INTERVAL_MS % 1000 * 1000;
         int activity;
         do {
             activity = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
@@ -173,13 +261,23 @@ int main(int argc, char* argv[]) {
             LOG_TO_FILE(errors, "Error in select which pipe reads");
             break;
         } else if (activity > 0) {
-            // Check if the map process has sent him the map size
+            // Check if the server has sent him the map size or a generation request, one per line
             if (FD_ISSET(target_read_map_fd, &read_fds)) {
-                ssize_t bytes_read = read(target_read_map_fd, buffer, sizeof(buffer) - 1);
+                ssize_t bytes_read = read(target_read_map_fd, buffer + length, sizeof(buffer) - 1 - length);
+                if (bytes_read == 0) break;
                 if (bytes_read > 0) {
-                    buffer[bytes_read] = '\0'; // End the string
-                    sscanf(buffer, "%d, %d", &game.max_x, &game.max_y);
-                    generate_targets();
+                    length += bytes_read;
+                    buffer[length] = '\0'; // End the string
+                    char *request = buffer, *end;
+                    while ((end = strchr(request, '\n')) != NULL) {
+                        *end = '\0';
+                        handle_request(request);
+                        request = end + 1;
+                    }
+                    // Keep the incomplete request for the next read, a line that fills the buffer is dropped
+                    length -= request - buffer;
+                    if (length == sizeof(buffer) - 1) length = 0;
+                    memmove(buffer, request, length);
                 }
             }
         }
@@ -194,6 +292,9 @@ int main(int argc, char* argv[]) {
         fclose(errors); 
         exit(EXIT_FAILURE);
     }
+    // Unmap the world
+    close(world_fd);
+    munmap(world, world->size);
     
     // Close the files
     fclose(debug);
@@ -0,0 +1,69 @@
+#ifndef TICK_SCHEDULER_H
+#define TICK_SCHEDULER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "latency.h"
+
+/**
+ * Fixed rate scheduler: the deadlines are absolute times on the monotonic clock, so the time
+ * spent computing a tick and the scheduler latency do not accumulate as drift.
+ * When a deadline is missed the late ticks are run back to back, up to max_catch_up of them;
+ * the ticks beyond that are dropped and counted as overruns, keeping the original phase.
+ */
+typedef struct {
+    uint64_t period;                        // Nanoseconds between two ticks
+    uint64_t deadline;                      // Absolute time of the next tick
+    int max_catch_up;                       // Late ticks that can be run back to back
+    atomic_ullong ticks;                    // Ticks run so far
+    atomic_ullong overruns;                 // Ticks dropped because too late
+    LatencyHistogram jitter;                // Delay between each deadline and the actual wake up
+} TickScheduler;
+
+static void tick_scheduler_init(TickScheduler *scheduler, double rate, int max_catch_up) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    scheduler->period = (uint64_t)(1e9 / rate);
+    scheduler->deadline = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec + scheduler->period;
+    scheduler->max_catch_up = max_catch_up < 0 ? 0 : max_catch_up;
+    atomic_init(&scheduler->ticks, 0);
+    atomic_init(&scheduler->overruns, 0);
+    memset(&scheduler->jitter, 0, sizeof(scheduler->jitter));
+    scheduler->jitter.name = "physics tick jitter";
+    atomic_init(&scheduler->jitter.min, UINT64_MAX);
+}
+
+// Sleep until the next deadline and return how many ticks have to be run now (at least one)
+static int tick_scheduler_wait(TickScheduler *scheduler) {
+    struct timespec deadline = {
+        .tv_sec = scheduler->deadline / 1000000000ULL,
+        .tv_nsec = scheduler->deadline % 1000000000ULL
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t late = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec - scheduler->deadline;
+    latency_record(&scheduler->jitter, late);
+
+    uint64_t due = 1 + late / scheduler->period;
+    uint64_t run = due > (uint64_t)scheduler->max_catch_up + 1 ? (uint64_t)scheduler->max_catch_up + 1 : due;
+    scheduler->deadline += due * scheduler->period;
+    atomic_fetch_add(&scheduler->overruns, due - run);
+    atomic_fetch_add(&scheduler->ticks, run);
+    return (int)run;
+}
+
+// Write a one line summary of the scheduler in the buffer
+static void tick_scheduler_format(TickScheduler *scheduler, char *buffer, size_t size) {
+    int length = snprintf(buffer, size, "Scheduler at %.1f Hz: %llu ticks, %llu overruns. ",
+                          1e9 / scheduler->period, atomic_load(&scheduler->ticks), atomic_load(&scheduler->overruns));
+    // The jitter follows in the same buffer, cut at its end like the prefix
+    if (length >= 0 && (size_t)length < size) latency_format(&scheduler->jitter, buffer + length, size - length);
+}
+
+#endif
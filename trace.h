@@ -0,0 +1,103 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_MAX_SITES 4096                  // Maximum number of LOG_TO_FILE call sites of one process
+#define LOG_MAX_ARGUMENTS 8                 // Integer arguments recorded by one LOG_EVENT, the others are dropped
+#define DEBUG_TRACE_FILE "debug.trace"      // Files written instead of debug.log and errors.log in binary mode
+#define ERRORS_TRACE_FILE "errors.trace"
+
+/**
+ * Binary trace format: a sequence of records, each one made of a TraceHeader followed by
+ * `length` bytes of payload. A writer emits a TRACE_CLOCK record when it starts, a TRACE_SITE
+ * record the first time a call site appears in the file and then only TRACE_EVENT records.
+ * A LOG_EVENT site is also described by a TRACE_FORMAT record, its events are TRACE_VALUES
+ * records with the raw arguments: they are formatted by arp-tracedump, never by the process.
+ * Records of different processes are told apart by the pid, so many writers can append to
+ * the same file. Use arp-tracedump to turn a trace back into the text format.
+ */
+enum {
+    TRACE_CLOCK = 1,                        // Payload: int64 offset (ns) from the monotonic clock to the wall clock
+    TRACE_SITE = 2,                         // Payload: uint32 line, then the name of the source file
+    TRACE_EVENT = 3,                        // Payload: the raw message
+    TRACE_FORMAT = 4,                       // Payload: the format string of the call site
+    TRACE_VALUES = 5                        // Payload: the int64 arguments of the event, formatted with the one of the site
+};
+
+typedef struct __attribute__((packed)) {
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t length;                        // Bytes of payload following the header
+    uint32_t pid;
+    uint32_t site;                          // Call site id, unique inside the process
+    uint64_t time;                          // CLOCK_MONOTONIC timestamp in nanoseconds
+} TraceHeader;
+
+/**
+ * Format integer arguments, taken in order, with a printf format. Only the integer conversions
+ * (d i u x X o c, with any flags, width, precision and length modifier) take an argument, any
+ * other conversion is copied as it is. Returns the length of the text written in `out`.
+ */
+static int trace_format(char *out, size_t size, const char *format, const int64_t *arguments, int count) {
+    size_t length = 0;
+    int used = 0;
+    const char *p = format;
+    if (size == 0) return 0;
+    while (*p != '\0' && length + 1 < size) {
+        if (*p != '%') {
+            out[length++] = *p++;
+            continue;
+        }
+        const char *start = p++;
+        if (*p == '%') {
+            out[length++] = *p++;
+            continue;
+        }
+
+        // Rebuild the conversion, with "ll" for every 64-bit length modifier
+        char spec[32];
+        size_t spec_length = 0;
+        spec[spec_length++] = '%';
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL) {
+            if (spec_length < sizeof(spec) - 4) spec[spec_length++] = *p;
+            p++;
+        }
+        int wide = 0;
+        while (*p != '\0' && strchr("hlzjt", *p) != NULL) {
+            if (*p == 'h' && spec_length < sizeof(spec) - 4) spec[spec_length++] = 'h';
+            else if (*p != 'h') wide = 1;
+            p++;
+        }
+        char conversion = *p;
+        if (conversion == '\0') break;
+        p++;
+
+        int n;
+        if (strchr("diuxXoc", conversion) == NULL) {
+            n = snprintf(out + length, size - length, "%.*s", (int)(p - start), start);
+        } else {
+            int64_t value = used < count ? arguments[used] : 0;
+            used++;
+            if (wide && conversion != 'c') {
+                spec[spec_length++] = 'l';
+                spec[spec_length++] = 'l';
+            }
+            spec[spec_length++] = conversion;
+            spec[spec_length] = '\0';
+            if (conversion == 'c') n = snprintf(out + length, size - length, spec, (int)value);
+            else if (wide && (conversion == 'd' || conversion == 'i')) n = snprintf(out + length, size - length, spec, (long long)value);
+            else if (wide) n = snprintf(out + length, size - length, spec, (unsigned long long)value);
+            else if (conversion == 'd' || conversion == 'i') n = snprintf(out + length, size - length, spec, (int)value);
+            else n = snprintf(out + length, size - length, spec, (unsigned int)value);
+        }
+        if (n < 0) break;
+        length += (size_t)n < size - length ? (size_t)n : size - length - 1;
+    }
+    out[length] = '\0';
+    return length;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "trace.h"
+
+#define MAX_PROCESSES 64                    // Number of different pids that can appear in one trace
+
+typedef struct {
+    uint32_t pid;
+    int64_t clock_offset;                   // Wall clock minus monotonic clock of the process
+    uint32_t lines[LOG_MAX_SITES];
+    char *sources[LOG_MAX_SITES];
+    char *formats[LOG_MAX_SITES];           // Formats of the LOG_EVENT sites
+} TraceProcess;
+
+TraceProcess processes[MAX_PROCESSES];
+int n_processes = 0;
+
+// Find the call site table of a process, creating it the first time the pid appears
+TraceProcess *get_process(uint32_t pid) {
+    for (int i = 0; i < n_processes; i++) {
+        if (processes[i].pid == pid) return &processes[i];
+    }
+    if (n_processes == MAX_PROCESSES) return NULL;
+    TraceProcess *process = &processes[n_processes++];
+    memset(process, 0, sizeof(TraceProcess));
+    process->pid = pid;
+    return process;
+}
+
+// Print one event in the same format used by the text log files
+void print_event(TraceProcess *process, TraceHeader *header, const char *payload) {
+    char time_now[50];
+    time_t second = (time_t)((header->time + process->clock_offset) / 1000000000LL);
+    struct tm local;
+    localtime_r(&second, &local);
+    strftime(time_now, sizeof(time_now), "%Y-%m-%d %H:%M:%S", &local);
+
+    if (header->site == 0) {
+        printf("[%s] => [logger] %.*s\n", time_now, header->length, payload);
+    } else if (header->site < LOG_MAX_SITES && process->sources[header->site] != NULL) {
+        printf("[%s] => Generated at line [%u] by [%s] with the following message: %.*s\n",
+               time_now, process->lines[header->site], process->sources[header->site], header->length, payload);
+    } else {
+        printf("[%s] => Generated at unknown site [%u] of process [%u] with the following message: %.*s\n",
+               time_now, header->site, process->pid, header->length, payload);
+    }
+}
+
+int dump_trace(const char *path) {
+    FILE *trace = fopen(path, "rb");
+    if (trace == NULL) {
+        perror("Error opening the trace file");
+        return -1;
+    }
+
+    TraceHeader header;
+    char payload[65536];
+    while (fread(&header, sizeof(header), 1, trace) == 1) {
+        if (fread(payload, 1, header.length, trace) != header.length) {
+            fprintf(stderr, "%s: truncated record\n", path);
+            break;
+        }
+        TraceProcess *process = get_process(header.pid);
+        if (process == NULL) {
+            fprintf(stderr, "%s: too many processes in the trace\n", path);
+            break;
+        }
+        switch (header.kind) {
+            case TRACE_CLOCK:
+                memcpy(&process->clock_offset, payload, sizeof(process->clock_offset));
+                // A new clock record means a new process with the same pid: forget its call sites
+                for (int i = 0; i < LOG_MAX_SITES; i++) {
+                    free(process->sources[i]);
+                    free(process->formats[i]);
+                    process->sources[i] = process->formats[i] = NULL;
+                }
+                break;
+            case TRACE_SITE:
+                if (header.site >= LOG_MAX_SITES || header.length < sizeof(uint32_t)) break;
+                memcpy(&process->lines[header.site], payload, sizeof(uint32_t));
+                free(process->sources[header.site]);
+                process->sources[header.site] = strndup(payload + sizeof(uint32_t), header.length - sizeof(uint32_t));
+                break;
+            case TRACE_EVENT:
+                print_event(process, &header, payload);
+                break;
+            case TRACE_FORMAT:
+                if (header.site >= LOG_MAX_SITES) break;
+                free(process->formats[header.site]);
+                process->formats[header.site] = strndup(payload, header.length);
+                break;
+            case TRACE_VALUES: {
+                // The arguments are formatted here, the process only recorded them
+                char message[4096];
+                int64_t arguments[LOG_MAX_ARGUMENTS];
+                int count = header.length / sizeof(int64_t);
+                if (count > LOG_MAX_ARGUMENTS) count = LOG_MAX_ARGUMENTS;
+                memcpy(arguments, payload, sizeof(int64_t) * count);
+                const char *format = header.site < LOG_MAX_SITES ? process->formats[header.site] : NULL;
+                header.length = trace_format(message, sizeof(message), format != NULL ? format : "(unknown format)", arguments, count);
+                print_event(process, &header, message);
+                break;
+            }
+            default:
+                fprintf(stderr, "%s: unknown record kind %d\n", path, header.kind);
+                break;
+        }
+    }
+
+    fclose(trace);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        // Without arguments decode the two traces of the current directory
+        dump_trace(DEBUG_TRACE_FILE);
+        dump_trace(ERRORS_TRACE_FILE);
+        return 0;
+    }
+
+    int result = EXIT_SUCCESS;
+    for (int i = 1; i < argc; i++) {
+        if (dump_trace(argv[i]) == -1) result = EXIT_FAILURE;
+    }
+    return result;
+}
@@ -5,166 +5,187 @@
 #include <unistd.h>
 #include <time.h>
 #include <sys/wait.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
 #include <stdbool.h>
 #include "helper.h"
+#include "event_loop.h"
+#include "heartbeat.h"
+
+#define TIMEOUT_NS (TIMEOUT * 1000000000ULL)   // Longest time allowed between two beats of a process
 
 pid_t pids[N_PROCS];                        // The pid of each process
 FILE *debug, *errors;                       // File descriptors for the two log files
-bool status[N_PROCS];                       // Used to check the response status for each process
+int timers[N_PROCS];                        // Deadline timer of each process
+Heartbeat *heartbeat;                       // Beats of the processes
+uint64_t start_time;                        // Monotonic time (ns) at which the supervision started
+int pidfds[N_PROCS];                        // Readable once the process terminates, -1 if not supervised this way
+bool exited[N_PROCS];                       // True once the process is known to be terminated
+int signal_fd = -1;                         // Signals sent to the watchdog
+const char *names[N_PROCS] = {"SERVER", "DRONE", "OBSTACLE", "TARGET", "INPUT"};
 
 // Function to get the current time as a string
 void get_current_time(char *buffer, int len) {
     time_t now = time(NULL);
     strftime(buffer, len, "%Y-%m-%d %H:%M:%S", localtime(&now));
 }
+// Send a signal through the pidfd of the process when there is one, so a recycled pid is never hit
+int signal_process(int i, int sig) {
+    if (pidfds[i] == -1) return kill(pids[i], sig);
+    return syscall(SYS_pidfd_send_signal, pidfds[i], sig, NULL, 0);
+}
+
 // Kill all processes
 void kill_processes() {
+    char message[128];
     for (int i = 0; i < N_PROCS; i++) {
-        if (kill(pids[i], SIGUSR2) == -1) {
+        if (exited[i]) continue;
+        if (signal_process(i, SIGUSR2) == -1) {
             perror("Error sending signal SIGUSR2 kill from the watchdog");
-            switch (i) {
-                case 0:
-                    LOG_TO_FILE(errors, "Error sending signal SIGUSR2 kill to the SERVER");
-                    break;
-                case 1:
-                    LOG_TO_FILE(errors, "Error sending signal SIGUSR2 kill to the DRONE");
-                    break;
-                case 2:
-                    LOG_TO_FILE(errors, "Error sending signal SIGUSR2 kill to the OBSTACLE");
-                    break;
-                case 3:
-                    LOG_TO_FILE(errors, "Error sending signal SIGUSR2 kill to the TARGET");
-                    break;
-                case 4:
-                    LOG_TO_FILE(errors, "Error sending signal SIGUSR2 kill to the INPUT");
-                    break;
-            }
+            snprintf(message, sizeof(message), "Error sending signal SIGUSR2 kill to the %s", names[i]);
+            LOG_TO_FILE(errors, message);
         }
     }
 }
 
-void signal_handler(int sig, siginfo_t* info, void *context) {
-    if (sig == SIGUSR1) {
-        pid_t pid = info->si_pid;
-        for (int i = 0; i < N_PROCS; i++) {
-            if (pid == pids[i]) {
-                switch (i) {
-                    case 0:
-                        LOG_TO_FILE(debug, "Received the signal from the SERVER");
-                        break;
-                    case 1:
-                        LOG_TO_FILE(debug, "Received the signal from the DRONE");
-                        break;
-                    case 2:
-                        LOG_TO_FILE(debug, "Received the signal from the OBSTACLE");
-                        break;
-                    case 3:
-                        LOG_TO_FILE(debug, "Received the signal from the TARGET");
-                        break;
-                    case 4:
-                        LOG_TO_FILE(debug, "Received the signal from the INPUT");
-                        break;
-                }
-                status[i] = true;
-            }
-        }
+// Kill all the processes, close the files and leave
+void shutdown_watchdog(int code) {
+    kill_processes();
+    // Close the files
+    fclose(debug);
+    fclose(errors);
+    exit(code);
+}
+
+// Arm the timer of a process to expire once, `delay` nanoseconds from now
+int arm_timer(int i, uint64_t delay) {
+    struct itimerspec spec = {0};
+    if (delay == 0) delay = 1;              // A zero expiration would disarm the timer
+    spec.it_value.tv_sec = delay / 1000000000ULL;
+    spec.it_value.tv_nsec = delay % 1000000000ULL;
+    return timerfd_settime(timers[i], 0, &spec, NULL);
+}
+
+/**
+ * Deadline of a process. If its last beat is older than TIMEOUT seconds every process is
+ * terminated, otherwise the timer is armed again to expire TIMEOUT seconds after that beat.
+ * The watchdog only reads the heartbeat page, the processes are never interrupted to answer.
+ */
+void handle_timer(int fd, uint32_t events, void *context) {
+    int i = (int)(intptr_t)context;
+    char message[256], current_time[32];
+    uint64_t expirations;
+
+    // Drain the expirations, the loop is edge-triggered
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+
+    // A process that has not beaten yet is given TIMEOUT seconds from the start of the supervision
+    uint64_t last = heartbeat_last(heartbeat, i);
+    if (last < start_time) last = start_time;
+    uint64_t now = monotonic_ns();
+    if (now - last > TIMEOUT_NS) {
+        get_current_time(current_time, sizeof(current_time));
+        snprintf(message, sizeof(message), "The %s process [%d] did not respond, or its last activity exceeded the timeout at %s", names[i], pids[i], current_time);
+        LOG_TO_FILE(debug, message);
+        shutdown_watchdog(EXIT_FAILURE);
     }
 
-    if (sig == SIGUSR2) {
-        LOG_TO_FILE(debug, "The keyboard manager has sent the termination signal, shutting down the drone and the server");
-        kill_processes();
-        // Close the files
-        fclose(debug);
-        fclose(errors);
-        exit(EXIT_SUCCESS);
+    if (arm_timer(i, last + TIMEOUT_NS - now + 1) == -1) {
+        perror("Error in timerfd_settime");
+        LOG_TO_FILE(errors, "Error in timerfd_settime");
+        shutdown_watchdog(EXIT_FAILURE);
     }
-    if (sig == SIGTERM) {
-        LOG_TO_FILE(debug, "WD");
+}
+
+// Signals of the processes, read from the signalfd instead of an asynchronous handler
+void handle_signals(int fd, uint32_t events, void *context) {
+    struct signalfd_siginfo info;
+
+    while (read(fd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGUSR2) {
+            LOG_TO_FILE(debug, "The keyboard manager has sent the termination signal, shutting down the drone and the server");
+            shutdown_watchdog(EXIT_SUCCESS);
+        }
+        // Terminating the watchdog terminates everything it supervises
+        if (info.ssi_signo == SIGTERM) {
+            LOG_TO_FILE(debug, "The watchdog was terminated, shutting down the processes");
+            shutdown_watchdog(EXIT_FAILURE);
+        }
     }
 }
 
-void watchdog(int timeout) {
+/**
+ * A supervised process has terminated: the pidfd tells at once instead of the next deadline.
+ * The watchdog is not its parent, so the exit status and the resources used are logged by the main,
+ * except for the keyboard manager under konsole, which logs them itself (log_own_exit).
+ */
+void handle_exit(int fd, uint32_t events, void *context) {
+    int i = (int)(intptr_t)context;
     char message[256], current_time[32];
 
-    time_t start, finish;
-    double diff; 
-    while (1) {
-        for (int i = 0; i < N_PROCS; i++) {
-            status[i] = false;
-            if (kill(pids[i], SIGUSR1) == -1) {
-                perror("Error sending signal SIGUSR1 kill from the watchdog");
-                kill_processes();
-                switch (i) {
-                    case 0:
-                        LOG_TO_FILE(errors, "Error sending signal SIGUSR1 kill to the SERVER");
-                        break;
-                    case 1:
-                        LOG_TO_FILE(errors, "Error sending signal SIGUSR1 kill to the DRONE");
-                        break;
-                    case 2:
-                        LOG_TO_FILE(errors, "Error sending signal SIGUSR1 kill to the OBSTACLE");
-                        break;
-                    case 3:
-                        LOG_TO_FILE(errors, "Error sending signal SIGUSR1 kill to the TARGET");
-                        break;
-                    case 4:
-                        LOG_TO_FILE(errors, "Error sending signal SIGUSR1 kill to the INPUT");
-                        break;
-                }
-                // Close the files
-                fclose(debug);
-                fclose(errors);
-                exit(EXIT_FAILURE);
-            }
-            /**
-             * Wait half a second so that the process has time to send the signal to update 
-             * the last activity to the watchdog
-            */
-            time(&start);
-            do {
-                time(&finish);
-                diff = difftime(finish, start);
-            } while (diff < 0.5);
+    // The keyboard manager asks for the shutdown before leaving, that exit is not a failure
+    handle_signals(signal_fd, 0, NULL);
+
+    exited[i] = true;
+    get_current_time(current_time, sizeof(current_time));
+    snprintf(message, sizeof(message), "The %s process [%d] terminated at %s", names[i], pids[i], current_time);
+    LOG_TO_FILE(debug, message);
+    shutdown_watchdog(EXIT_FAILURE);
+}
+
+/**
+ * Event loop of the watchdog: one timerfd per process and a signalfd for the shutdown, so
+ * the watchdog sleeps in epoll_wait between events instead of spinning on time().
+ * Every process follows its own deadline, pushed forward by its beats.
+ * A pidfd per process reports its termination as soon as it happens.
+ */
+void watchdog() {
+    EventLoop loop;
+    if (event_loop_init(&loop) == -1) {
+        perror("Error in epoll_create1");
+        LOG_TO_FILE(errors, "Error in epoll_create1");
+        shutdown_watchdog(EXIT_FAILURE);
+    }
+    if (event_loop_add(&loop, signal_fd, handle_signals, NULL) == -1) {
+        perror("Error adding the signalfd to the event loop");
+        LOG_TO_FILE(errors, "Error adding the signalfd to the event loop");
+        shutdown_watchdog(EXIT_FAILURE);
+    }
+
+    char message[128];
+    for (int i = 0; i < N_PROCS; i++) {
+        // Without pidfds (kernels before 5.3) the processes are supervised by the deadlines only
+        pidfds[i] = syscall(SYS_pidfd_open, pids[i], 0);
+        if (pidfds[i] == -1 && errno != ENOSYS) {
+            perror("Error in pidfd_open");
+            snprintf(message, sizeof(message), "The %s process [%d] cannot be supervised", names[i], pids[i]);
+            LOG_TO_FILE(errors, message);
+            shutdown_watchdog(EXIT_FAILURE);
+        }
+        if (pidfds[i] != -1 && event_loop_add(&loop, pidfds[i], handle_exit, (void *)(intptr_t)i) == -1) {
+            perror("Error adding a pidfd to the event loop");
+            LOG_TO_FILE(errors, "Error adding a pidfd to the event loop");
+            shutdown_watchdog(EXIT_FAILURE);
         }
 
-        // Wait TIMEOUT second before checking the processes' activities
-        time(&start);
-        do {
-            time(&finish);
-            diff = difftime(finish, start);
-        } while (diff < TIMEOUT);
-
-        for (int i = 0; i < N_PROCS; i++) {
-            if (!status[i]) {
-                get_current_time(current_time, sizeof(current_time));
-                switch (i) {
-                    case 0:
-                        snprintf(message, sizeof(message), "The SERVER process [%d] did not respond, or its last activity exceeded the timeout at %s", pids[i], current_time);
-                        LOG_TO_FILE(debug, message);
-                        break;
-                    case 1:
-                        snprintf(message, sizeof(message), "The DRONE process [%d] did not respond, or its last activity exceeded the timeout at %s", pids[i], current_time);
-                        LOG_TO_FILE(debug, message);
-                        break;
-                    case 2:
-                        snprintf(message, sizeof(message), "The OBSTACLE process [%d] did not respond, or its last activity exceeded the timeout at %s", pids[i], current_time);
-                        LOG_TO_FILE(debug, message);
-                        break;
-                    case 3:
-                        snprintf(message, sizeof(message), "The TARGET process [%d] did not respond, or its last activity exceeded the timeout at %s", pids[i], current_time);
-                        LOG_TO_FILE(debug, message);
-                        break;
-                    case 4:
-                        snprintf(message, sizeof(message), "The INPUT process [%d] did not respond, or its last activity exceeded the timeout at %s", pids[i], current_time);
-                        LOG_TO_FILE(debug, message);
-                        break;
-                }
-                kill_processes();
-                // Close the files
-                fclose(debug);
-                fclose(errors);
-                exit(EXIT_FAILURE);
-            }
+        timers[i] = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timers[i] == -1 || event_loop_add(&loop, timers[i], handle_timer, (void *)(intptr_t)i) == -1 ||
+            arm_timer(i, TIMEOUT_NS) == -1) {
+            perror("Error creating the timer of a process");
+            LOG_TO_FILE(errors, "Error creating the timer of a process");
+            shutdown_watchdog(EXIT_FAILURE);
+        }
+    }
+
+    // The keyboard manager signals its end to the pid published here
+    atomic_store(&heartbeat->watchdog, getpid());
+
+    while (1) {
+        if (event_loop_wait(&loop, -1) == -1) {
+            perror("Error in epoll_wait");
+            LOG_TO_FILE(errors, "Error in epoll_wait");
+            shutdown_watchdog(EXIT_FAILURE);
         }
     }
 }
@@ -183,6 +204,8 @@ int main(int argc, char* argv[]) {
         kill_processes();
         exit(EXIT_FAILURE);
     }
+    // Start the background writer of the log files
+    start_log_writer(debug, errors);
 
     if (argc != N_PROCS + 1) {
         LOG_TO_FILE(errors, "Invalid number of parameters");
@@ -197,46 +220,38 @@ int main(int argc, char* argv[]) {
     /* SAVED THE CHILD PIDS */
     for (int i = 0; i < N_PROCS; i++) {
         pids[i] = atoi(argv[i+1]);
+        pidfds[i] = -1;
     }
 
-    /* SETTING THE SIGNALS */
-    struct sigaction sa;
-    sa.sa_flags = SA_SIGINFO;
-    sa.sa_sigaction = signal_handler;
-    sigemptyset(&sa.sa_mask);
-
-    // Set the signal handler for SIGUSR1
-    if (sigaction(SIGUSR1, &sa, NULL) == -1) {
-        perror("Error in sigaction(SIGURS1)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS1)");
-        kill_processes();
-        // Close the files
-        fclose(debug);
-        fclose(errors);
-        exit(EXIT_FAILURE);
+    /* OPEN THE HEARTBEAT */
+    heartbeat = heartbeat_open();
+    if (heartbeat == NULL) {
+        perror("Error opening the heartbeat shared memory");
+        LOG_TO_FILE(errors, "Error opening the heartbeat shared memory");
+        shutdown_watchdog(EXIT_FAILURE);
     }
-    // Set the signal handler for SIGUSR2
-    if(sigaction(SIGUSR2, &sa, NULL) == -1){
-        perror("Error in sigaction(SIGURS2)");
-        kill_processes();
-        LOG_TO_FILE(errors, "Error in sigaction(SIGURS2)");
-        // Close the files
-        fclose(debug);
-        fclose(errors);
-        exit(EXIT_FAILURE);
+    start_time = monotonic_ns();
+
+    /* SETTING THE SIGNALS */
+    // Block the signals and receive them from a signalfd in the event loop
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR2);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        perror("Error in sigprocmask");
+        LOG_TO_FILE(errors, "Error in sigprocmask");
+        shutdown_watchdog(EXIT_FAILURE);
     }
-    // Set the signal handler for SIGTERM
-    if(sigaction(SIGTERM, &sa, NULL) == -1){
-        perror("Error in sigaction(SIGTERM)");
-        LOG_TO_FILE(errors, "Error in sigaction(SIGTERM)");
-        // Close the files
-        fclose(debug);
-        fclose(errors);
-        exit(EXIT_FAILURE);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd == -1) {
+        perror("Error in signalfd");
+        LOG_TO_FILE(errors, "Error in signalfd");
+        shutdown_watchdog(EXIT_FAILURE);
     }
 
     /* LAUNCH THE WATCHDOG */
-    watchdog(TIMEOUT);
+    watchdog();
 
     /* END THE PROGRAM */
     // Close the files
@@ -244,4 +259,4 @@ int main(int argc, char* argv[]) {
     fclose(errors);
     
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,134 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdatomic.h>
+
+#define WORLD_SHARED_MEMORY "/world_memory" // Name of the shared memory with the obstacles and the targets
+#define WORLD_MAGIC 0x4d485357u              // "WSHM" in little endian
+#define WORLD_OBSTACLES 0
+#define WORLD_TARGETS 1
+#define WORLD_SETS 2
+
+/**
+ * One set of objects in the world segment, stored as structure of arrays: x[capacity],
+ * y[capacity] and point[capacity] start at `offset` bytes from the beginning of the segment.
+ * The set is published under a seqlock like the drone: the generator makes the sequence odd,
+ * rewrites the arrays and makes it even again, so a reader detects a new set by comparing a
+ * single integer and copies it without ever blocking the generator.
+ */
+typedef struct {
+    atomic_uint sequence;                   // Odd while the generator is writing the set
+    uint32_t generation;                    // Generation number given by the generator
+    uint32_t count;                         // Objects currently published
+    uint32_t capacity;                      // Objects the arrays can hold
+    uint64_t offset;
+} WorldSet;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t size;                          // Bytes of the whole segment
+    WorldSet sets[WORLD_SETS];
+} World;
+
+// Private copy of a set, the arrays grow to the largest set read
+typedef struct {
+    unsigned int version;                   // world_version() of the set when it was copied
+    uint32_t generation;
+    uint32_t count;
+    uint32_t capacity;
+    int32_t *x, *y, *point;
+} WorldSnapshot;
+
+static inline size_t world_set_bytes(uint32_t capacity) {
+    return sizeof(int32_t) * 3 * (size_t)capacity;
+}
+
+// Bytes needed by a world with room for the given number of obstacles and targets
+static inline size_t world_size(uint32_t n_obstacles, uint32_t n_targets) {
+    return sizeof(World) + world_set_bytes(n_obstacles) + world_set_bytes(n_targets);
+}
+
+// Lay out an empty world in a zeroed segment of world_size() bytes
+static inline void world_init(World *world, uint32_t n_obstacles, uint32_t n_targets) {
+    world->size = world_size(n_obstacles, n_targets);
+    world->sets[WORLD_OBSTACLES].capacity = n_obstacles;
+    world->sets[WORLD_OBSTACLES].offset = sizeof(World);
+    world->sets[WORLD_TARGETS].capacity = n_targets;
+    world->sets[WORLD_TARGETS].offset = sizeof(World) + world_set_bytes(n_obstacles);
+    atomic_thread_fence(memory_order_release);
+    world->magic = WORLD_MAGIC;
+}
+
+static inline int32_t *world_x(World *world, int set) {
+    return (int32_t *)((char *)world + world->sets[set].offset);
+}
+
+static inline int32_t *world_y(World *world, int set) {
+    return world_x(world, set) + world->sets[set].capacity;
+}
+
+static inline int32_t *world_point(World *world, int set) {
+    return world_y(world, set) + world->sets[set].capacity;
+}
+
+// Version of a set, it changes every time the generator publishes it
+static inline unsigned int world_version(World *world, int set) {
+    return atomic_load_explicit(&world->sets[set].sequence, memory_order_acquire) & ~1u;
+}
+
+// Only the generator of a set writes it, between these two calls
+static inline void world_write_begin(World *world, int set) {
+    atomic_fetch_add_explicit(&world->sets[set].sequence, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static inline void world_write_end(World *world, int set, uint32_t generation, uint32_t count) {
+    world->sets[set].generation = generation;
+    world->sets[set].count = count < world->sets[set].capacity ? count : world->sets[set].capacity;
+    atomic_fetch_add_explicit(&world->sets[set].sequence, 1, memory_order_release);
+}
+
+// Copy a consistent snapshot of a set, returns -1 when the arrays of the snapshot cannot grow
+static int world_read(World *world, int set, WorldSnapshot *snapshot) {
+    uint32_t capacity = world->sets[set].capacity;
+    if (capacity > snapshot->capacity) {
+        int32_t *x = realloc(snapshot->x, sizeof(int32_t) * capacity);
+        if (x != NULL) snapshot->x = x;
+        int32_t *y = realloc(snapshot->y, sizeof(int32_t) * capacity);
+        if (y != NULL) snapshot->y = y;
+        int32_t *point = realloc(snapshot->point, sizeof(int32_t) * capacity);
+        if (point != NULL) snapshot->point = point;
+        if (x == NULL || y == NULL || point == NULL) return -1;
+        snapshot->capacity = capacity;
+    }
+
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&world->sets[set].sequence, memory_order_acquire);
+        if (before & 1) continue;
+        uint32_t count = world->sets[set].count;
+        if (count > capacity) count = capacity;
+        snapshot->generation = world->sets[set].generation;
+        snapshot->count = count;
+        memcpy(snapshot->x, world_x(world, set), sizeof(int32_t) * count);
+        memcpy(snapshot->y, world_y(world, set), sizeof(int32_t) * count);
+        memcpy(snapshot->point, world_point(world, set), sizeof(int32_t) * count);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&world->sets[set].sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    snapshot->version = before;
+    return 0;
+}
+
+static void world_snapshot_free(WorldSnapshot *snapshot) {
+    free(snapshot->x);
+    free(snapshot->y);
+    free(snapshot->point);
+    snapshot->x = snapshot->y = snapshot->point = NULL;
+    snapshot->capacity = snapshot->count = 0;
+}
+
+#endif